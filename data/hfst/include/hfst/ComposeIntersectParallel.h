@@ -0,0 +1,619 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+#ifndef COMPOSE_INTERSECT_PARALLEL_H
+#define COMPOSE_INTERSECT_PARALLEL_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+#include <limits>
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "ComposeIntersectRule.h"
+#include "../../HfstFlagDiacritics.h"
+
+namespace hfst
+{
+  namespace implementations
+  {
+    // Composes a lexicon with the intersection of twolc rules using several
+    // threads.
+    //
+    // The rules form a balanced tree of rule pairs, shared by all workers.
+    // As in ComposeIntersectRulePair, the intersection of a pair is computed
+    // lazily, only for the states and symbols the composition reaches. Each
+    // node of the tree has a lock of its own, which is not held while the
+    // node asks its children, so independent rule pairs are intersected
+    // concurrently by the workers that need them. Rule pairs number their
+    // states as they find them, so the numbers depend on the threads, but
+    // each pair state has one number for all workers. The order of the
+    // transitions of a pair state only depends on the order of the
+    // transitions of its children.
+    //
+    // ComposeIntersectRule adds the rule symbols to the global symbol table
+    // of HfstTropicalTransducerTransitionData, which is not thread-safe, so
+    // the rules are constructed on the calling thread before any worker
+    // starts. Workers only read the table through the indexed lexicon.
+    //
+    // Product states are explored breadth-first, one level at a time. The
+    // states of a level are handed out to the workers in chunks from a
+    // shared cursor, so idle workers keep taking work until the level is
+    // done. The table of known product states is only read while a level
+    // is expanded. New states are numbered afterwards, in a sequential pass
+    // over the level, in the order a FIFO agenda would have found them, so
+    // the result is the same for any number of threads.
+    //
+    // Lexicon arcs are matched on their output symbols against rule arcs on
+    // their input symbols. Lexicon arcs with an epsilon or flag diacritic
+    // output and rule arcs with an epsilon input move one side only; a
+    // lexicon-only move is not taken right after a rule-only move, so that
+    // each pair of paths is composed once. Unknown and identity symbols
+    // are matched literally, so the lexicon and the rules need to be
+    // harmonized beforehand, as for ComposeIntersectLexicon.
+    class ComposeIntersectParallel
+    {
+    public:
+      // rules must not be empty. Zero threads means one per hardware
+      // thread.
+      ComposeIntersectParallel(const HfstBasicTransducer &lexicon,
+                               const std::vector<HfstBasicTransducer> &rules,
+                               unsigned int threads = 0);
+      ~ComposeIntersectParallel(void);
+
+      HfstBasicTransducer compose(void);
+
+    protected:
+      struct RuleArc
+      {
+        size_t ilabel;
+        size_t olabel;
+        float weight;
+        HfstState target;
+      };
+
+      typedef std::vector<RuleArc> RuleArcVector;
+
+      // A rule, or the intersection of two rule nodes, which it owns. The
+      // transitions of a state are computed when they are first asked for
+      // and kept until the node is destroyed, so the references returned
+      // stay valid. Safe to use from several threads.
+      class RuleNode
+      {
+      public:
+        // Takes the ownership of rule.
+        RuleNode(ComposeIntersectRule *rule);
+        RuleNode(RuleNode *first,RuleNode *second);
+        ~RuleNode(void);
+        const RuleArcVector &get_transitions(HfstState s,size_t symbol);
+        float get_final_weight(HfstState s);
+      private:
+        typedef std::pair<HfstState,HfstState> StatePair;
+
+        struct HashStatePair
+        {
+          size_t operator() (const StatePair &p) const
+          { return p.first * 0x9E3779B1u + p.second; }
+        };
+
+        ComposeIntersectRule *rule;
+        RuleNode *first;
+        RuleNode *second;
+        std::mutex mutex;
+        // Rule pairs only
+        std::vector<StatePair> pairs;
+        std::unordered_map<StatePair,HfstState,HashStatePair> pair_numbers;
+        std::vector<float> final_weights;
+        std::unordered_map<StatePair,std::unique_ptr<RuleArcVector>,
+                           HashStatePair> transitions;
+
+        HfstState get_pair_state(const StatePair &p);
+        RuleArcVector *intersect(const RuleArcVector &arcs1,
+                                 const RuleArcVector &arcs2);
+      };
+
+      struct ProductState
+      {
+        HfstState lexicon_state;
+        HfstState rule_state;
+        bool lexicon_epsilons_allowed;
+        bool operator==(const ProductState &another) const
+        {
+          return lexicon_state == another.lexicon_state &&
+            rule_state == another.rule_state &&
+            lexicon_epsilons_allowed == another.lexicon_epsilons_allowed;
+        }
+      };
+
+      struct HashProductState
+      {
+        size_t operator() (const ProductState &s) const
+        {
+          size_t h = s.lexicon_state;
+          h = h * 0x9E3779B1u + s.rule_state;
+          return h * 2 + (s.lexicon_epsilons_allowed ? 1 : 0);
+        }
+      };
+
+      struct LexiconArc
+      {
+        size_t ilabel;
+        size_t olabel;
+        float weight;
+        HfstState target;
+      };
+
+      struct PendingArc
+      {
+        size_t ilabel;
+        size_t olabel;
+        float weight;
+        ProductState target;
+        HfstState target_number;
+      };
+
+      struct Expansion
+      {
+        std::vector<PendingArc> arcs;
+        bool final;
+        float final_weight;
+      };
+
+      struct ResultArc
+      {
+        size_t ilabel;
+        size_t olabel;
+        float weight;
+        HfstState target;
+      };
+
+      typedef std::vector<LexiconArc> LexiconArcVector;
+      typedef std::unordered_map<ProductState,HfstState,HashProductState>
+    ProductStateMap;
+
+      static const HfstState NO_STATE = static_cast<HfstState>(-1);
+      static const size_t CHUNK_SIZE = 64;
+
+      // Per lexicon state: arcs that move the lexicon only, and the other
+      // arcs sorted by output symbol
+      std::vector<LexiconArcVector> lexicon_skip_arcs;
+      std::vector<LexiconArcVector> lexicon_match_arcs;
+      std::vector<float> lexicon_final_weights;
+      std::vector<bool> lexicon_final;
+      RuleNode *rule_tree;
+      unsigned int thread_count;
+
+      ProductStateMap product_states;
+      std::vector<ProductState> state_vector;
+      std::vector<std::vector<ResultArc> > result_arcs;
+      std::vector<float> result_final_weights;
+      std::vector<bool> result_final;
+
+      static bool is_final_weight(float w)
+      { return w != std::numeric_limits<float>::infinity(); }
+
+      static bool is_lexicon_skip_symbol(size_t symbol)
+      {
+        return symbol == 0 || FdOperation::is_diacritic
+          (HfstTropicalTransducerTransitionData::get_symbol(symbol));
+      }
+
+      // A balanced tree over the rules from begin to end
+      static RuleNode * make_rule_tree
+    (std::vector<ComposeIntersectRule *> &rules,size_t begin,size_t end);
+
+      void index_lexicon(const HfstBasicTransducer &lexicon);
+      HfstState find_state(const ProductState &s) const;
+      void add_pending_arc(Expansion &expansion,size_t ilabel,size_t olabel,
+                           float weight,const ProductState &target) const;
+      void expand(const ProductState &s,Expansion &expansion) const;
+      void expand_level(const std::vector<HfstState> &level,
+                        std::vector<Expansion> &expansions);
+      void number_level(const std::vector<HfstState> &level,
+                        std::vector<Expansion> &expansions,
+                        std::vector<HfstState> &next_level);
+    };
+
+    inline ComposeIntersectParallel::RuleNode::RuleNode
+    (ComposeIntersectRule *rule):
+      rule(rule), first(NULL), second(NULL)
+    {}
+
+    inline ComposeIntersectParallel::RuleNode::RuleNode
+    (RuleNode *first,RuleNode *second):
+      rule(NULL), first(first), second(second)
+    {
+      get_pair_state(StatePair(ComposeIntersectFst::START,
+                               ComposeIntersectFst::START));
+    }
+
+    inline ComposeIntersectParallel::RuleNode::~RuleNode(void)
+    {
+      delete rule;
+      delete first;
+      delete second;
+    }
+
+    inline HfstState ComposeIntersectParallel::RuleNode::get_pair_state
+    (const StatePair &p)
+    {
+      // Called with mutex held. The children take their own locks, and a
+      // node never waits for its parent, so this cannot deadlock.
+      std::pair<std::unordered_map<StatePair,HfstState,HashStatePair>::iterator,
+                bool> inserted =
+        pair_numbers.insert(std::make_pair(p,static_cast<HfstState>
+                                           (pairs.size())));
+      if (inserted.second)
+        {
+          pairs.push_back(p);
+          float weight1 = first->get_final_weight(p.first);
+          float weight2 = second->get_final_weight(p.second);
+          final_weights.push_back
+            (is_final_weight(weight1) && is_final_weight(weight2) ?
+             weight1 + weight2 : std::numeric_limits<float>::infinity());
+        }
+      return inserted.first->second;
+    }
+
+    inline ComposeIntersectParallel::RuleArcVector *
+    ComposeIntersectParallel::RuleNode::intersect
+    (const RuleArcVector &arcs1,const RuleArcVector &arcs2)
+    {
+      RuleArcVector *arcs = new RuleArcVector;
+      for (RuleArcVector::const_iterator it = arcs1.begin();
+           it != arcs1.end(); ++it)
+        {
+          for (RuleArcVector::const_iterator jt = arcs2.begin();
+               jt != arcs2.end(); ++jt)
+            {
+              if (it->olabel != jt->olabel)
+                { continue; }
+              RuleArc arc = { it->ilabel, it->olabel, it->weight + jt->weight,
+                              get_pair_state(StatePair(it->target,
+                                                       jt->target)) };
+              arcs->push_back(arc);
+            }
+        }
+      return arcs;
+    }
+
+    inline const ComposeIntersectParallel::RuleArcVector &
+    ComposeIntersectParallel::RuleNode::get_transitions
+    (HfstState s,size_t symbol)
+    {
+      StatePair key(s,symbol);
+      std::unique_lock<std::mutex> lock(mutex);
+      std::unordered_map<StatePair,std::unique_ptr<RuleArcVector>,
+                         HashStatePair>::const_iterator it =
+        transitions.find(key);
+      if (it != transitions.end())
+        { return *it->second; }
+
+      std::unique_ptr<RuleArcVector> arcs;
+      if (rule != NULL)
+        {
+          // ComposeIntersectRule caches what it computes, so the lock is
+          // held while it is asked.
+          const ComposeIntersectFst::TransitionSet &rule_transitions =
+            rule->get_transitions(s,symbol);
+          arcs.reset(new RuleArcVector);
+          for (ComposeIntersectFst::TransitionSet::const_iterator jt =
+                 rule_transitions.begin(); jt != rule_transitions.end(); ++jt)
+            {
+              RuleArc arc = { jt->ilabel, jt->olabel, jt->weight,
+                              jt->target };
+              arcs->push_back(arc);
+            }
+        }
+      else
+        {
+          // The children are asked without the lock, so that other workers
+          // can use this node meanwhile. If another worker computes the
+          // same transitions first, its result is kept.
+          StatePair p = pairs[s];
+          lock.unlock();
+          const RuleArcVector &arcs1 = first->get_transitions(p.first,symbol);
+          const RuleArcVector &arcs2 =
+            second->get_transitions(p.second,symbol);
+          lock.lock();
+          it = transitions.find(key);
+          if (it != transitions.end())
+            { return *it->second; }
+          arcs.reset(intersect(arcs1,arcs2));
+        }
+      return *transitions.insert(std::make_pair(key,std::move(arcs)))
+        .first->second;
+    }
+
+    inline float ComposeIntersectParallel::RuleNode::get_final_weight
+    (HfstState s)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (rule != NULL)
+        { return rule->get_final_weight(s); }
+      return final_weights[s];
+    }
+
+    inline ComposeIntersectParallel::ComposeIntersectParallel
+    (const HfstBasicTransducer &lexicon,
+     const std::vector<HfstBasicTransducer> &rules,unsigned int threads):
+      rule_tree(NULL), thread_count(threads)
+    {
+      if (rules.empty())
+        {
+          HFST_THROW_MESSAGE(HfstFatalException,
+                             "compose-intersect needs at least one rule");
+        }
+      if (thread_count == 0)
+        { thread_count = std::max(1u,std::thread::hardware_concurrency()); }
+      index_lexicon(lexicon);
+      std::vector<ComposeIntersectRule *> leaves;
+      try
+        {
+          for (size_t i = 0; i < rules.size(); ++i)
+            { leaves.push_back(new ComposeIntersectRule(rules[i])); }
+        }
+      catch (...)
+        {
+          for (size_t i = 0; i < leaves.size(); ++i)
+            { delete leaves[i]; }
+          throw;
+        }
+      rule_tree = make_rule_tree(leaves,0,leaves.size());
+    }
+
+    inline ComposeIntersectParallel::~ComposeIntersectParallel(void)
+    { delete rule_tree; }
+
+    inline ComposeIntersectParallel::RuleNode *
+    ComposeIntersectParallel::make_rule_tree
+    (std::vector<ComposeIntersectRule *> &rules,size_t begin,size_t end)
+    {
+      if (end - begin == 1)
+        { return new RuleNode(rules[begin]); }
+      size_t middle = begin + (end - begin) / 2;
+      return new RuleNode(make_rule_tree(rules,begin,middle),
+                          make_rule_tree(rules,middle,end));
+    }
+
+    inline void ComposeIntersectParallel::index_lexicon
+    (const HfstBasicTransducer &lexicon)
+    {
+      size_t state_count = lexicon.get_max_state() + 1;
+      lexicon_skip_arcs.assign(state_count,LexiconArcVector());
+      lexicon_match_arcs.assign(state_count,LexiconArcVector());
+      lexicon_final_weights.assign(state_count,0.0);
+      lexicon_final.assign(state_count,false);
+      for (HfstState s = 0; s < state_count; ++s)
+        {
+          const HfstBasicTransitions &transitions = lexicon.transitions(s);
+          for (HfstBasicTransitions::const_iterator it = transitions.begin();
+               it != transitions.end(); ++it)
+            {
+              LexiconArc arc = { it->get_input_number(),
+                                 it->get_output_number(),
+                                 it->get_weight(),
+                                 it->get_target_state() };
+              if (is_lexicon_skip_symbol(arc.olabel))
+                { lexicon_skip_arcs[s].push_back(arc); }
+              else
+                { lexicon_match_arcs[s].push_back(arc); }
+            }
+          std::stable_sort(lexicon_match_arcs[s].begin(),
+                           lexicon_match_arcs[s].end(),
+                           [](const LexiconArc &a1,const LexiconArc &a2)
+                           { return a1.olabel < a2.olabel; });
+          if (lexicon.is_final_state(s))
+            {
+              lexicon_final[s] = true;
+              lexicon_final_weights[s] = lexicon.get_final_weight(s);
+            }
+        }
+    }
+
+    inline HfstState ComposeIntersectParallel::find_state
+    (const ProductState &s) const
+    {
+      ProductStateMap::const_iterator it = product_states.find(s);
+      if (it == product_states.end())
+        { return NO_STATE; }
+      return it->second;
+    }
+
+    inline void ComposeIntersectParallel::add_pending_arc
+    (Expansion &expansion,size_t ilabel,size_t olabel,float weight,
+     const ProductState &target) const
+    {
+      PendingArc arc = { ilabel, olabel, weight, target, find_state(target) };
+      expansion.arcs.push_back(arc);
+    }
+
+    inline void ComposeIntersectParallel::expand
+    (const ProductState &s,Expansion &expansion) const
+    {
+      expansion.arcs.clear();
+      float rule_final_weight = rule_tree->get_final_weight(s.rule_state);
+      expansion.final = lexicon_final[s.lexicon_state] &&
+        is_final_weight(rule_final_weight);
+      expansion.final_weight = expansion.final ?
+        lexicon_final_weights[s.lexicon_state] + rule_final_weight : 0.0;
+
+      if (s.lexicon_epsilons_allowed)
+        {
+          const LexiconArcVector &skip_arcs =
+            lexicon_skip_arcs[s.lexicon_state];
+          for (LexiconArcVector::const_iterator it = skip_arcs.begin();
+               it != skip_arcs.end(); ++it)
+            {
+              ProductState target = { it->target, s.rule_state, true };
+              add_pending_arc(expansion,it->ilabel,it->olabel,it->weight,
+                              target);
+            }
+        }
+
+      const RuleArcVector &rule_epsilons =
+        rule_tree->get_transitions(s.rule_state,0);
+      for (RuleArcVector::const_iterator it =
+             rule_epsilons.begin(); it != rule_epsilons.end(); ++it)
+        {
+          ProductState target = { s.lexicon_state, it->target, false };
+          add_pending_arc(expansion,0,it->olabel,it->weight,target);
+        }
+
+      const LexiconArcVector &match_arcs = lexicon_match_arcs[s.lexicon_state];
+      LexiconArcVector::const_iterator run_start = match_arcs.begin();
+      while (run_start != match_arcs.end())
+        {
+          LexiconArcVector::const_iterator run_end = run_start;
+          while (run_end != match_arcs.end() &&
+                 run_end->olabel == run_start->olabel)
+            { ++run_end; }
+          const RuleArcVector &rule_transitions =
+            rule_tree->get_transitions(s.rule_state,run_start->olabel);
+          for (LexiconArcVector::const_iterator it = run_start;
+               it != run_end; ++it)
+            {
+              for (RuleArcVector::const_iterator jt =
+                     rule_transitions.begin();
+                   jt != rule_transitions.end(); ++jt)
+                {
+                  ProductState target = { it->target, jt->target, true };
+                  add_pending_arc(expansion,it->ilabel,jt->olabel,
+                                  it->weight + jt->weight,target);
+                }
+            }
+          run_start = run_end;
+        }
+    }
+
+    inline void ComposeIntersectParallel::expand_level
+    (const std::vector<HfstState> &level,std::vector<Expansion> &expansions)
+    {
+      expansions.resize(level.size());
+      std::atomic<size_t> cursor(0);
+      auto work = [this,&level,&expansions,&cursor](void)
+        {
+          for (;;)
+            {
+              size_t begin = cursor.fetch_add(CHUNK_SIZE);
+              if (begin >= level.size())
+                { break; }
+              size_t end = std::min(begin + CHUNK_SIZE,level.size());
+              for (size_t i = begin; i < end; ++i)
+                { expand(state_vector[level[i]],expansions[i]); }
+            }
+        };
+      size_t worker_count =
+        std::min(static_cast<size_t>(thread_count),
+                 (level.size() + CHUNK_SIZE - 1) / CHUNK_SIZE);
+      std::vector<std::thread> workers;
+      for (size_t i = 1; i < worker_count; ++i)
+        { workers.push_back(std::thread(work)); }
+      work();
+      for (size_t i = 0; i < workers.size(); ++i)
+        { workers[i].join(); }
+    }
+
+    inline void ComposeIntersectParallel::number_level
+    (const std::vector<HfstState> &level,std::vector<Expansion> &expansions,
+     std::vector<HfstState> &next_level)
+    {
+      next_level.clear();
+      for (size_t i = 0; i < level.size(); ++i)
+        {
+          HfstState source = level[i];
+          Expansion &expansion = expansions[i];
+          result_final[source] = expansion.final;
+          result_final_weights[source] = expansion.final_weight;
+          // Not a reference into result_arcs, which grows in the loop
+          std::vector<ResultArc> arcs;
+          arcs.reserve(expansion.arcs.size());
+          for (std::vector<PendingArc>::const_iterator it =
+                 expansion.arcs.begin(); it != expansion.arcs.end(); ++it)
+            {
+              HfstState target = it->target_number;
+              if (target == NO_STATE)
+                {
+                  // Unknown when the level was expanded; it may have been
+                  // numbered earlier in this pass.
+                  std::pair<ProductStateMap::iterator,bool> inserted =
+                    product_states.insert
+                    (std::make_pair(it->target,
+                                    static_cast<HfstState>(state_vector.size())));
+                  target = inserted.first->second;
+                  if (inserted.second)
+                    {
+                      state_vector.push_back(it->target);
+                      result_arcs.push_back(std::vector<ResultArc>());
+                      result_final_weights.push_back(0.0);
+                      result_final.push_back(false);
+                      next_level.push_back(target);
+                    }
+                }
+              ResultArc arc = { it->ilabel, it->olabel, it->weight, target };
+              arcs.push_back(arc);
+            }
+          result_arcs[source].swap(arcs);
+          std::vector<PendingArc>().swap(expansion.arcs);
+        }
+    }
+
+    inline HfstBasicTransducer ComposeIntersectParallel::compose(void)
+    {
+      product_states.clear();
+      state_vector.clear();
+      result_arcs.clear();
+      result_final_weights.clear();
+      result_final.clear();
+
+      ProductState start = { 0, ComposeIntersectFst::START, true };
+      product_states[start] = 0;
+      state_vector.push_back(start);
+      result_arcs.push_back(std::vector<ResultArc>());
+      result_final_weights.push_back(0.0);
+      result_final.push_back(false);
+
+      std::vector<HfstState> level(1,0);
+      std::vector<HfstState> next_level;
+      std::vector<Expansion> expansions;
+      while (!level.empty())
+        {
+          expand_level(level,expansions);
+          number_level(level,expansions,next_level);
+          level.swap(next_level);
+        }
+
+      HfstBasicTransducer result;
+      result.add_state(state_vector.size() - 1);
+      for (HfstState s = 0; s < state_vector.size(); ++s)
+        {
+          for (std::vector<ResultArc>::const_iterator it =
+                 result_arcs[s].begin(); it != result_arcs[s].end(); ++it)
+            {
+              result.add_transition
+                (s,HfstBasicTransition
+                 (it->target,
+                  HfstTropicalTransducerTransitionData::get_symbol(it->ilabel),
+                  HfstTropicalTransducerTransitionData::get_symbol(it->olabel),
+                  it->weight));
+            }
+          if (result_final[s])
+            { result.set_final_weight(s,result_final_weights[s]); }
+        }
+      return result;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,232 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+#ifndef HARMONIZATION_CACHE
+#define HARMONIZATION_CACHE
+
+#include <set>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "HfstDataTypes.h"
+#include "HfstSymbolDefs.h"
+#include "implementations/HfstBasicTransducer.h"
+#include "HarmonizeUnknownAndIdentitySymbols.h"
+
+namespace hfst
+{
+
+// A version of an alphabet: an order-independent fingerprint of its
+// symbols, which can be updated as symbols are added, and its size.
+// Equal alphabets have equal versions.
+struct AlphabetVersion
+{
+  uint64_t fingerprint;
+  size_t size;
+
+  AlphabetVersion(): fingerprint(0), size(0) {}
+
+  // The version of @a alphabet.
+  AlphabetVersion(const StringSet &alphabet): fingerprint(0), size(0)
+  {
+    for (StringSet::const_iterator it = alphabet.begin();
+         it != alphabet.end(); ++it)
+      { insert(*it); }
+  }
+
+  // Update the version for adding @a symbol, which must not be in the
+  // alphabet yet.
+  void insert(const std::string &symbol)
+  {
+    // FNV-1a, mixed so that xor-combining symbols does not cancel out
+    uint64_t h = 14695981039346656037ULL;
+    for (std::string::const_iterator it = symbol.begin();
+         it != symbol.end(); ++it)
+      {
+        h ^= static_cast<unsigned char>(*it);
+        h *= 1099511628211ULL;
+      }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    fingerprint ^= h;
+    ++size;
+  }
+
+  bool operator==(const AlphabetVersion &another) const
+  { return fingerprint == another.fingerprint && size == another.size; }
+};
+
+// The symbols of a transducer, its alphabet and the symbols of its
+// transitions, together with their version. A caller that harmonizes the
+// same transducer repeatedly can keep one up to date with insert() as it
+// adds symbols, instead of having it recomputed from the transducer.
+struct VersionedAlphabet
+{
+  StringSet symbols;
+  AlphabetVersion version;
+
+  VersionedAlphabet() {}
+
+  // The symbols of @a t.
+  explicit VersionedAlphabet(const HfstBasicTransducer &t)
+  {
+    const StringSet &alphabet = t.get_alphabet();
+    for (StringSet::const_iterator it = alphabet.begin();
+         it != alphabet.end(); ++it)
+      { insert(*it); }
+    for (HfstBasicTransducer::const_iterator it = t.begin(); it != t.end();
+         ++it)
+      {
+        for (hfst::implementations::HfstBasicTransitions::const_iterator tr =
+               it->begin(); tr != it->end(); ++tr)
+          {
+            insert(tr->get_input_symbol());
+            insert(tr->get_output_symbol());
+          }
+      }
+  }
+
+  // Add @a symbol, if it is not there yet. Returns whether it was added.
+  bool insert(const std::string &symbol)
+  {
+    if (!symbols.insert(symbol).second)
+      { return false; }
+    version.insert(symbol);
+    return true;
+  }
+};
+
+// Harmonizes transducers against a set of fixed transducers, such as rules
+// that many transducers are composed with, and remembers the results.
+//
+// Harmonizing t with a fixed transducer r as HarmonizeUnknownAndIdentitySymbols
+// does expands the identity and unknown transitions of r with the symbols
+// of t that r does not know, and vice versa. The expanded r only depends on
+// r and the symbols of t, so it is kept for each set of symbols seen, and
+// later transducers with equal symbols get it without harmonizing r again.
+// Only t is then expanded, with the symbols of r. The symbols of a
+// transducer are its alphabet and the symbols of its transitions, as in
+// VersionedAlphabet.
+class HarmonizationCache
+{
+ public:
+  typedef size_t Handle;
+
+  HarmonizationCache(): hit_count(0), miss_count(0) {}
+
+  // Add a copy of @a t as a fixed transducer.
+  Handle add(const HfstBasicTransducer &t)
+  {
+    Fixed fixed;
+    fixed.transducer = t;
+    fixed.symbols = VersionedAlphabet(t).symbols;
+    // A transducer that only carries the symbols of t, to expand other
+    // transducers with
+    fixed.symbol_carrier.add_state(1);
+    for (StringSet::const_iterator it = fixed.symbols.begin();
+         it != fixed.symbols.end(); ++it)
+      {
+        fixed.symbol_carrier.add_transition
+          (0, HfstBasicTransition(1, *it, *it, 0.0));
+      }
+    fixed_transducers.push_back(fixed);
+    return fixed_transducers.size() - 1;
+  }
+
+  // Harmonize @a t with the fixed transducer @a h. @a t is expanded in
+  // place, and the expanded fixed transducer is returned. It stays valid
+  // until the cache is cleared or destroyed.
+  const HfstBasicTransducer &harmonize(Handle h, HfstBasicTransducer &t)
+  {
+    VersionedAlphabet symbols(t);
+    return harmonize(h, t, symbols);
+  }
+
+  // The same, with the symbols of @a t already known. @a symbols must be
+  // VersionedAlphabet(t), or kept equal to it by the caller. It is updated
+  // with the symbols that @a t gains, so that it can be used for @a t
+  // again without being recomputed.
+  const HfstBasicTransducer &harmonize(Handle h, HfstBasicTransducer &t,
+                                       VersionedAlphabet &symbols)
+  {
+    Fixed &fixed = fixed_transducers.at(h);
+    const HfstBasicTransducer *result = NULL;
+    std::pair<ExpansionMap::iterator, ExpansionMap::iterator> range =
+      fixed.expansions.equal_range(symbols.version.fingerprint);
+    for (ExpansionMap::iterator it = range.first; it != range.second; ++it)
+      {
+        if (it->second.symbols == symbols.symbols)
+          {
+            ++hit_count;
+            HfstBasicTransducer carrier(fixed.symbol_carrier);
+            HarmonizeUnknownAndIdentitySymbols(t, carrier);
+            result = &it->second.transducer;
+            break;
+          }
+      }
+    if (result == NULL)
+      {
+        ++miss_count;
+        Expansion expansion;
+        expansion.symbols = symbols.symbols;
+        expansion.transducer = fixed.transducer;
+        HarmonizeUnknownAndIdentitySymbols(t, expansion.transducer);
+        result = &fixed.expansions.insert
+          (std::make_pair(symbols.version.fingerprint, expansion))
+          ->second.transducer;
+      }
+    for (StringSet::const_iterator it = fixed.symbols.begin();
+         it != fixed.symbols.end(); ++it)
+      { symbols.insert(*it); }
+    return *result;
+  }
+
+  // The number of harmonizations that were found in the cache and that
+  // were not.
+  size_t hits() const { return hit_count; }
+  size_t misses() const { return miss_count; }
+
+  // Forget the expansions, but keep the fixed transducers.
+  void clear_expansions()
+  {
+    for (std::deque<Fixed>::iterator it = fixed_transducers.begin();
+         it != fixed_transducers.end(); ++it)
+      { it->expansions.clear(); }
+  }
+
+ protected:
+  struct Expansion
+  {
+    StringSet symbols;
+    HfstBasicTransducer transducer;
+  };
+
+  typedef std::unordered_multimap<uint64_t, Expansion> ExpansionMap;
+
+  struct Fixed
+  {
+    HfstBasicTransducer transducer;
+    StringSet symbols;
+    HfstBasicTransducer symbol_carrier;
+    ExpansionMap expansions;
+  };
+
+  // A deque, so that returned expansions stay in place
+  std::deque<Fixed> fixed_transducers;
+  size_t hit_count;
+  size_t miss_count;
+};
+
+}
+
+#endif // HARMONIZATION_CACHE
@@ -0,0 +1,716 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+#ifndef _HFST_ATT_FORMAT_H_
+#define _HFST_ATT_FORMAT_H_
+
+/** @file HfstAttFormat.h
+    @brief Classes HfstAttReader and HfstAttWriter */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "HfstBasicTransducer.h"
+
+namespace hfst {
+  namespace implementations {
+
+    /** @brief A reader for transducers in AT&T format that parses a file
+        in parallel.
+
+        The input is split into chunks at line boundaries, which worker
+        threads parse with their own symbol tables. The symbols are then
+        numbered once per chunk, and the transitions of the chunks are
+        added to the transducers in file order. The format is that of
+        HfstBasicTransducer::read_in_att_format(): fields are separated by
+        tabs or spaces, "@0@", "@_EPSILON_SYMBOL_@" and \a epsilon_symbol
+        are epsilons, "@_SPACE_@", "@_TAB_@" and "@_COLON_@" stand for the
+        characters they name, and transducers are separated by lines
+        beginning with "-". Blank lines are skipped. */
+    class HfstAttReader
+    {
+    public:
+      HfstAttReader(const std::string &epsilon_symbol = "@0@",
+                    unsigned int threads = 0):
+        epsilon_symbol(epsilon_symbol), thread_count(threads)
+      {
+        if (thread_count == 0)
+          {
+            thread_count =
+              std::max(1u, std::thread::hardware_concurrency());
+          }
+      }
+
+      /** @brief Read all transducers in the file \a filename, which is
+          memory-mapped where possible.
+
+          @throws StreamNotReadableException
+          @throws NotValidAttFormatException */
+      std::vector<HfstBasicTransducer>
+      read_file(const std::string &filename) const
+      {
+#ifndef _MSC_VER
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+          { HFST_THROW_MESSAGE(StreamNotReadableException, filename); }
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+          {
+            close(fd);
+            HFST_THROW_MESSAGE(StreamNotReadableException, filename);
+          }
+        size_t size = st.st_size;
+        if (size == 0)
+          {
+            close(fd);
+            return std::vector<HfstBasicTransducer>();
+          }
+        void * data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+          { HFST_THROW_MESSAGE(StreamNotReadableException, filename); }
+        madvise(data, size, MADV_SEQUENTIAL);
+        std::vector<HfstBasicTransducer> retval;
+        try
+          { retval = read(static_cast<const char *>(data), size); }
+        catch (...)
+          {
+            munmap(data, size);
+            throw;
+          }
+        munmap(data, size);
+        return retval;
+#else
+        FILE * file = fopen(filename.c_str(), "rb");
+        if (file == NULL)
+          { HFST_THROW_MESSAGE(StreamNotReadableException, filename); }
+        std::vector<char> data;
+        char buffer[65536];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), file)) != 0)
+          { data.insert(data.end(), buffer, buffer + n); }
+        fclose(file);
+        return read(data.data(), data.size());
+#endif
+      }
+
+      /** @brief Read all transducers in the \a size bytes at \a data.
+
+          @throws NotValidAttFormatException */
+      std::vector<HfstBasicTransducer> read(const char * data,
+                                            size_t size) const
+      {
+        std::vector<Chunk> chunks(std::max<size_t>
+                                  (1, std::min<size_t>
+                                   (thread_count * 4,
+                                    size / MIN_CHUNK_SIZE)));
+        size_t position = 0;
+        for (size_t i = 0; i < chunks.size(); ++i)
+          {
+            chunks[i].begin = data + position;
+            size_t end = (i + 1 == chunks.size()) ? size :
+              std::max(position, size * (i + 1) / chunks.size());
+            const char * newline = static_cast<const char *>
+              (memchr(data + end, '\n', size - end));
+            position = newline == NULL ? size : newline - data + 1;
+            chunks[i].end = data + position;
+          }
+
+        std::atomic<size_t> cursor(0);
+        auto work = [this, &chunks, &cursor]()
+          {
+            size_t i;
+            while ((i = cursor.fetch_add(1)) < chunks.size())
+              { parse(chunks[i]); }
+          };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < std::min<size_t>(thread_count, chunks.size());
+             ++i)
+          { workers.push_back(std::thread(work)); }
+        work();
+        for (size_t i = 0; i < workers.size(); ++i)
+          { workers[i].join(); }
+
+        for (std::vector<Chunk>::const_iterator it = chunks.begin();
+             it != chunks.end(); ++it)
+          {
+            if (!it->error.empty())
+              { HFST_THROW_MESSAGE(NotValidAttFormatException, it->error); }
+          }
+
+        // Number the symbols of each chunk and gather the segments of
+        // each transducer
+        std::vector<std::vector<const Segment *> > transducers(1);
+        for (std::vector<Chunk>::iterator it = chunks.begin();
+             it != chunks.end(); ++it)
+          {
+            it->numbers.resize(it->symbols.size());
+            for (size_t i = 0; i < it->symbols.size(); ++i)
+              {
+                it->numbers[i] = HfstTropicalTransducerTransitionData::
+                  get_number(it->symbols[i]);
+              }
+            for (size_t i = 0; i < it->segments.size(); ++i)
+              {
+                if (i != 0)
+                  { transducers.push_back(std::vector<const Segment *>()); }
+                transducers.back().push_back(&it->segments[i]);
+              }
+          }
+        // A final separator does not begin a transducer
+        if (transducers.size() > 1)
+          {
+            bool empty = true;
+            for (size_t i = 0; i < transducers.back().size(); ++i)
+              {
+                empty = empty && transducers.back()[i]->arcs.empty() &&
+                  transducers.back()[i]->finals.empty();
+              }
+            if (empty)
+              { transducers.pop_back(); }
+          }
+
+        std::vector<HfstBasicTransducer> retval;
+        if (size == 0)
+          { return retval; }
+        retval.resize(transducers.size());
+        for (size_t i = 0; i < transducers.size(); ++i)
+          { build(transducers[i], retval[i]); }
+        return retval;
+      }
+
+    protected:
+      static const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+      struct Arc
+      {
+        HfstState source;
+        HfstState target;
+        unsigned int input;
+        unsigned int output;
+        float weight;
+      };
+
+      struct Final
+      {
+        HfstState state;
+        float weight;
+      };
+
+      struct Chunk;
+
+      // The lines of a chunk between two separators
+      struct Segment
+      {
+        const Chunk * chunk;
+        std::vector<Arc> arcs;
+        std::vector<Final> finals;
+      };
+
+      struct Chunk
+      {
+        const char * begin;
+        const char * end;
+        std::vector<Segment> segments;
+        // Symbols by chunk-local number, and their global numbers
+        std::vector<std::string> symbols;
+        std::unordered_map<std::string, unsigned int> local_numbers;
+        std::vector<unsigned int> numbers;
+        std::string error;
+        Chunk(): begin(NULL), end(NULL) {}
+      };
+
+      std::string epsilon_symbol;
+      unsigned int thread_count;
+
+      static bool is_space(char c)
+      { return c == ' ' || c == '\t' || c == '\r'; }
+
+      static bool parse_state(const char * begin, const char * end,
+                              HfstState &state)
+      {
+        if (begin == end)
+          { return false; }
+        HfstState value = 0;
+        for (const char * p = begin; p != end; ++p)
+          {
+            if (*p < '0' || *p > '9')
+              { return false; }
+            value = value * 10 + (*p - '0');
+          }
+        state = value;
+        return true;
+      }
+
+      // Plain decimals are parsed by hand, anything else with strtod
+      static bool parse_weight(const char * begin, const char * end,
+                               float &weight)
+      {
+        const char * p = begin;
+        bool negative = false;
+        if (p != end && (*p == '-' || *p == '+'))
+          { negative = (*p++ == '-'); }
+        double value = 0.0;
+        int digits = 0;
+        while (p != end && *p >= '0' && *p <= '9')
+          {
+            value = value * 10 + (*p++ - '0');
+            ++digits;
+          }
+        if (p != end && *p == '.')
+          {
+            ++p;
+            double scale = 0.1;
+            while (p != end && *p >= '0' && *p <= '9')
+              {
+                value += (*p++ - '0') * scale;
+                scale /= 10;
+                ++digits;
+              }
+          }
+        // A weight needs at least one digit; "." and "+." are not weights
+        if (p == end && digits == 0)
+          { return false; }
+        if (p == end && digits <= 15)
+          {
+            weight = static_cast<float>(negative ? -value : value);
+            return true;
+          }
+        std::string field(begin, end);
+        char * field_end;
+        weight = static_cast<float>(strtod(field.c_str(), &field_end));
+        return field_end != field.c_str() && *field_end == '\0';
+      }
+
+      static void replace_all(std::string &str, const std::string &from,
+                              const std::string &to)
+      {
+        size_t pos = 0;
+        while ((pos = str.find(from, pos)) != std::string::npos)
+          {
+            str.replace(pos, from.size(), to);
+            pos += to.size();
+          }
+      }
+
+      unsigned int symbol(Chunk &chunk, const char * begin,
+                          const char * end) const
+      {
+        std::string name(begin, end);
+        if (memchr(begin, '@', end - begin) != NULL)
+          {
+            replace_all(name, "@_SPACE_@", " ");
+            replace_all(name, "@0@", internal_epsilon);
+            replace_all(name, "@_TAB_@", "\t");
+            replace_all(name, "@_COLON_@", ":");
+          }
+        if (name == epsilon_symbol)
+          { name = internal_epsilon; }
+        std::pair<std::unordered_map<std::string, unsigned int>::iterator,
+                  bool> inserted =
+          chunk.local_numbers.insert
+          (std::make_pair(name, chunk.symbols.size()));
+        if (inserted.second)
+          { chunk.symbols.push_back(name); }
+        return inserted.first->second;
+      }
+
+      void parse(Chunk &chunk) const
+      {
+        chunk.segments.resize(1);
+        chunk.segments.back().chunk = &chunk;
+        const char * line = chunk.begin;
+        while (line != chunk.end)
+          {
+            const char * line_end = static_cast<const char *>
+              (memchr(line, '\n', chunk.end - line));
+            if (line_end == NULL)
+              { line_end = chunk.end; }
+            const char * next = line_end == chunk.end ? line_end
+              : line_end + 1;
+
+            if (*line == '-')
+              {
+                chunk.segments.push_back(Segment());
+                chunk.segments.back().chunk = &chunk;
+                line = next;
+                continue;
+              }
+            const char * fields[5][2];
+            int n = 0;
+            const char * p = line;
+            while (n < 5)
+              {
+                while (p != line_end && is_space(*p))
+                  { ++p; }
+                if (p == line_end)
+                  { break; }
+                fields[n][0] = p;
+                while (p != line_end && !is_space(*p))
+                  { ++p; }
+                fields[n][1] = p;
+                ++n;
+              }
+            while (p != line_end && is_space(*p))
+              { ++p; }
+            if (p != line_end)
+              {
+                // More than five fields
+                chunk.error.assign(line, line_end);
+                return;
+              }
+            if (n == 0)
+              {
+                line = next;
+                continue;
+              }
+            Segment &segment = chunk.segments.back();
+            bool ok = false;
+            if (n == 1 || n == 2)
+              {
+                Final f = { 0, 0.0 };
+                ok = parse_state(fields[0][0], fields[0][1], f.state) &&
+                  (n == 1 ||
+                   parse_weight(fields[1][0], fields[1][1], f.weight));
+                segment.finals.push_back(f);
+              }
+            else if (n == 4 || n == 5)
+              {
+                Arc a = { 0, 0, 0, 0, 0.0 };
+                ok = parse_state(fields[0][0], fields[0][1], a.source) &&
+                  parse_state(fields[1][0], fields[1][1], a.target) &&
+                  (n == 4 ||
+                   parse_weight(fields[4][0], fields[4][1], a.weight));
+                a.input = symbol(chunk, fields[2][0], fields[2][1]);
+                a.output = symbol(chunk, fields[3][0], fields[3][1]);
+                segment.arcs.push_back(a);
+              }
+            if (!ok)
+              {
+                chunk.error.assign(line, line_end);
+                return;
+              }
+            line = next;
+          }
+      }
+
+      static void build(const std::vector<const Segment *> &segments,
+                        HfstBasicTransducer &t)
+      {
+        HfstState max_state = 0;
+        std::vector<char> used_symbols;
+        for (std::vector<const Segment *>::const_iterator it =
+               segments.begin(); it != segments.end(); ++it)
+          {
+            const std::vector<unsigned int> &numbers = (*it)->chunk->numbers;
+            for (std::vector<Arc>::const_iterator a = (*it)->arcs.begin();
+                 a != (*it)->arcs.end(); ++a)
+              {
+                max_state = std::max(max_state,
+                                     std::max(a->source, a->target));
+                unsigned int symbols[2] = { numbers[a->input],
+                                            numbers[a->output] };
+                for (int i = 0; i < 2; ++i)
+                  {
+                    if (used_symbols.size() <= symbols[i])
+                      { used_symbols.resize(symbols[i] + 1, 0); }
+                    used_symbols[symbols[i]] = 1;
+                  }
+              }
+            for (std::vector<Final>::const_iterator f =
+                   (*it)->finals.begin(); f != (*it)->finals.end(); ++f)
+              { max_state = std::max(max_state, f->state); }
+          }
+
+        HfstBasicTransducer::HfstAlphabet alphabet;
+        for (unsigned int i = 0; i < used_symbols.size(); ++i)
+          {
+            if (used_symbols[i])
+              {
+                alphabet.insert(HfstTropicalTransducerTransitionData::
+                                get_symbol(i));
+              }
+          }
+        t.add_symbols_to_alphabet(alphabet);
+        if (max_state > 0)
+          { t.add_state(max_state); }
+
+        std::vector<size_t> counts(max_state + 1, 0);
+        for (std::vector<const Segment *>::const_iterator it =
+               segments.begin(); it != segments.end(); ++it)
+          {
+            for (std::vector<Arc>::const_iterator a = (*it)->arcs.begin();
+                 a != (*it)->arcs.end(); ++a)
+              { ++counts[a->source]; }
+          }
+        for (HfstState s = 0; s <= max_state; ++s)
+          { t.transitions(s).reserve(counts[s]); }
+        for (std::vector<const Segment *>::const_iterator it =
+               segments.begin(); it != segments.end(); ++it)
+          {
+            const std::vector<unsigned int> &numbers = (*it)->chunk->numbers;
+            for (std::vector<Arc>::const_iterator a = (*it)->arcs.begin();
+                 a != (*it)->arcs.end(); ++a)
+              {
+                t.transitions(a->source).push_back
+                  (HfstBasicTransition(a->target, numbers[a->input],
+                                       numbers[a->output], a->weight,
+                                       false));
+              }
+            for (std::vector<Final>::const_iterator f =
+                   (*it)->finals.begin(); f != (*it)->finals.end(); ++f)
+              { t.set_final_weight(f->state, f->weight); }
+          }
+      }
+    };
+
+    /** @brief A buffered writer for transducers in AT&T format, in the
+        format of HfstBasicTransducer::write_in_att_format(FILE*, bool).
+
+        Weights are formatted as with "%f" without going through printf
+        for ordinary values, the escaped form of each symbol is computed
+        once, and ranges of states are formatted by worker threads into
+        buffers that are written in order. Consecutive transducers are
+        separated by "--" lines. */
+    class HfstAttWriter
+    {
+    public:
+      HfstAttWriter(FILE * file, bool write_weights = true,
+                    unsigned int threads = 0):
+        file(file), write_weights(write_weights), thread_count(threads),
+        written(0)
+      {
+        if (thread_count == 0)
+          {
+            thread_count =
+              std::max(1u, std::thread::hardware_concurrency());
+          }
+      }
+
+      /** @brief Write \a t.
+
+          @throws StreamCannotBeWrittenException */
+      void write(const HfstBasicTransducer &t)
+      {
+        if (written++ != 0)
+          { put(std::string("--\n")); }
+        HfstState state_count = t.get_max_state() + 1;
+        // Cut the states into ranges of about CHUNK_ARCS transitions
+        std::vector<HfstState> cuts(1, 0);
+        size_t arcs = 0;
+        for (HfstState s = 0; s < state_count; ++s)
+          {
+            arcs += t.transitions(s).size() + 1;
+            if (arcs >= CHUNK_ARCS)
+              {
+                cuts.push_back(s + 1);
+                arcs = 0;
+              }
+          }
+        if (cuts.back() != state_count)
+          { cuts.push_back(state_count); }
+        prepare_symbols(t);
+
+        std::vector<std::string> buffers(thread_count);
+        for (size_t round = 0; round + 1 < cuts.size();
+             round += thread_count)
+          {
+            size_t count = std::min<size_t>(thread_count,
+                                            cuts.size() - 1 - round);
+            std::atomic<size_t> cursor(0);
+            auto work = [this, &t, &cuts, &buffers, &cursor, round, count]()
+              {
+                size_t i;
+                while ((i = cursor.fetch_add(1)) < count)
+                  {
+                    buffers[i].clear();
+                    format(t, cuts[round + i], cuts[round + i + 1],
+                           buffers[i]);
+                  }
+              };
+            std::vector<std::thread> workers;
+            for (size_t i = 1; i < count; ++i)
+              { workers.push_back(std::thread(work)); }
+            work();
+            for (size_t i = 0; i < workers.size(); ++i)
+              { workers[i].join(); }
+            for (size_t i = 0; i < count; ++i)
+              { put(buffers[i]); }
+          }
+      }
+
+      /** @brief Append the "%f" form of \a weight to \a out. */
+      static void format_weight(float weight, std::string &out)
+      {
+        double value = weight;
+        if (!(std::fabs(value) < 1e12))
+          {
+            char buffer[64];
+            snprintf(buffer, sizeof(buffer), "%f", value);
+            out += buffer;
+            return;
+          }
+        if (std::signbit(value))
+          {
+            out += '-';
+            value = -value;
+          }
+        // Exact for floats, and rounds ties to even as printf does
+        long long scaled = static_cast<long long>(std::nearbyint(value * 1e6));
+        format_number(scaled / 1000000, out);
+        out += '.';
+        long long fraction = scaled % 1000000;
+        char digits[6];
+        for (int i = 5; i >= 0; --i)
+          {
+            digits[i] = '0' + fraction % 10;
+            fraction /= 10;
+          }
+        out.append(digits, 6);
+      }
+
+    protected:
+      static const size_t CHUNK_ARCS = 1 << 16;
+
+      FILE * file;
+      bool write_weights;
+      unsigned int thread_count;
+      size_t written;
+      // Escaped symbols by symbol number, with a trailing separator
+      std::vector<std::string> input_names;
+      std::vector<std::string> output_names;
+
+      static void format_number(unsigned long long number, std::string &out)
+      {
+        char digits[24];
+        int n = 0;
+        do
+          {
+            digits[n++] = '0' + number % 10;
+            number /= 10;
+          }
+        while (number != 0);
+        while (n > 0)
+          { out += digits[--n]; }
+      }
+
+      static std::string escape(const std::string &symbol)
+      {
+        std::string escaped;
+        for (std::string::const_iterator it = symbol.begin();
+             it != symbol.end(); ++it)
+          {
+            if (*it == ' ')
+              { escaped += "@_SPACE_@"; }
+            else if (*it == '\t')
+              { escaped += "@_TAB_@"; }
+            else
+              { escaped += *it; }
+          }
+        size_t pos = 0;
+        const std::string epsilon(internal_epsilon);
+        while ((pos = escaped.find(epsilon, pos)) != std::string::npos)
+          {
+            escaped.replace(pos, epsilon.size(), "@0@");
+            pos += 3;
+          }
+        return escaped;
+      }
+
+      void prepare_symbols(const HfstBasicTransducer &t)
+      {
+        for (HfstState s = 0; s <= t.get_max_state(); ++s)
+          {
+            const HfstBasicTransitions &transitions = t.transitions(s);
+            for (HfstBasicTransitions::const_iterator it =
+                   transitions.begin(); it != transitions.end(); ++it)
+              {
+                unsigned int numbers[2] = { it->get_input_number(),
+                                            it->get_output_number() };
+                for (int i = 0; i < 2; ++i)
+                  {
+                    if (input_names.size() <= numbers[i])
+                      {
+                        input_names.resize(numbers[i] + 1);
+                        output_names.resize(numbers[i] + 1);
+                      }
+                    if (input_names[numbers[i]].empty())
+                      {
+                        std::string escaped =
+                          escape(HfstTropicalTransducerTransitionData::
+                                 get_symbol(numbers[i]));
+                        input_names[numbers[i]] = escaped + '\t';
+                        output_names[numbers[i]] = escaped;
+                      }
+                  }
+              }
+          }
+      }
+
+      void format(const HfstBasicTransducer &t, HfstState first,
+                  HfstState last, std::string &out) const
+      {
+        for (HfstState s = first; s < last; ++s)
+          {
+            const HfstBasicTransitions &transitions = t.transitions(s);
+            for (HfstBasicTransitions::const_iterator it =
+                   transitions.begin(); it != transitions.end(); ++it)
+              {
+                format_number(s, out);
+                out += '\t';
+                format_number(it->get_target_state(), out);
+                out += '\t';
+                out += input_names[it->get_input_number()];
+                out += output_names[it->get_output_number()];
+                if (write_weights)
+                  {
+                    out += '\t';
+                    format_weight(it->get_weight(), out);
+                  }
+                out += '\n';
+              }
+            if (t.is_final_state(s))
+              {
+                format_number(s, out);
+                if (write_weights)
+                  {
+                    out += '\t';
+                    format_weight(t.get_final_weight(s), out);
+                  }
+                out += '\n';
+              }
+          }
+      }
+
+      void put(const std::string &buffer)
+      {
+        if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size())
+          { HFST_THROW(StreamCannotBeWrittenException); }
+      }
+    };
+
+  }
+}
+
+#endif // #ifndef _HFST_ATT_FORMAT_H_
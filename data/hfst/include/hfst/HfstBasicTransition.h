@@ -108,6 +108,7 @@ namespace hfst {
         friend class ComposeIntersectLexicon;
         friend class ComposeIntersectRule;
         friend class ComposeIntersectRulePair;
+        friend class ComposeIntersectParallel;
       };
   }
   
@@ -0,0 +1,411 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+#ifndef _HFST_DETERMINIZER_H_
+#define _HFST_DETERMINIZER_H_
+
+/** @file HfstDeterminizer.h
+    @brief Class HfstDeterminizer */
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+
+#include "HfstFrozenTransducer.h"
+
+namespace hfst {
+  namespace implementations {
+
+    /** @brief Weighted subset construction for HfstBasicTransducer, with
+        the subsets of a level expanded by several threads.
+
+        The transducer is treated as an automaton over symbol pairs, and
+        epsilon:epsilon transitions are removed on the way. A state of the
+        result is a subset of (state, residual weight) pairs, sorted by
+        state. By default residuals are compared exactly, as in the
+        backend's determinization.
+
+        Quantization is opt-in: with a positive \a delta, residuals are
+        rounded to the nearest multiple of \a delta, so that subsets whose
+        residuals differ only by float rounding are merged. This can make
+        the construction terminate on inputs where float errors would
+        otherwise create new subsets forever, but the result is then only
+        equivalent up to an error of about \a delta per transition.
+
+        The subsets are handled breadth-first one level at a time. Worker
+        threads take subsets of the current level from a shared cursor and
+        compute their transitions, looking up known target subsets in the
+        subset table, which is not modified during a level. New subsets are
+        then numbered in one sequential pass in the order a FIFO agenda
+        would have found them, so the result does not depend on the number
+        of threads.
+
+        As with any weighted subset construction, the weights must not be
+        negative, and a weighted transducer that has no deterministic
+        equivalent makes the construction run forever. */
+    class HfstDeterminizer
+    {
+    public:
+      /** @brief Prepare to determinize \a t with \a threads threads, or
+          one per hardware thread if zero, rounding residual weights to
+          multiples of \a delta if it is positive. */
+      HfstDeterminizer(const HfstBasicTransducer &t,
+                       unsigned int threads = 0,
+                       float delta = 0.0):
+        fsm(t), name(t.name), delta(delta), thread_count(threads),
+        epsilon(HfstFrozenTransducer::symbol_number(internal_epsilon))
+      {
+        if (thread_count == 0)
+          {
+            thread_count =
+              std::max(1u, std::thread::hardware_concurrency());
+          }
+      }
+
+      /** @brief The determinized transducer. */
+      HfstBasicTransducer determinize()
+      {
+        subsets.clear();
+        subset_ids.clear();
+        result_arcs.clear();
+        result_final.clear();
+        result_final_weights.clear();
+
+        Subset start(1, Element(0, 0.0));
+        close(start);
+        add_subset(start);
+
+        std::vector<HfstState> level(1, 0);
+        std::vector<HfstState> next_level;
+        std::vector<Expansion> expansions;
+        while (!level.empty())
+          {
+            expand_level(level, expansions);
+            number_level(level, expansions, next_level);
+            level.swap(next_level);
+          }
+
+        HfstBasicTransducer retval;
+        retval.name = name;
+        HfstBasicTransducer::HfstAlphabet alphabet;
+        for (std::vector<unsigned int>::const_iterator it =
+               fsm.get_alphabet().begin();
+             it != fsm.get_alphabet().end(); ++it)
+          { alphabet.insert(HfstFrozenTransducer::symbol_name(*it)); }
+        retval.add_symbols_to_alphabet(alphabet);
+        if (subsets.size() > 1)
+          { retval.add_state(subsets.size() - 1); }
+        for (HfstState s = 0; s < subsets.size(); ++s)
+          {
+            HfstBasicTransitions &transitions = retval.transitions(s);
+            transitions.reserve(result_arcs[s].size());
+            for (std::vector<ResultArc>::const_iterator it =
+                   result_arcs[s].begin(); it != result_arcs[s].end(); ++it)
+              {
+                transitions.push_back
+                  (HfstBasicTransition(it->target, it->input, it->output,
+                                       it->weight, false));
+              }
+            if (result_final[s])
+              { retval.set_final_weight(s, result_final_weights[s]); }
+          }
+        return retval;
+      }
+
+    protected:
+      struct Element
+      {
+        HfstState state;
+        float residual;
+        Element(HfstState s, float r): state(s), residual(r) {}
+        bool operator==(const Element &another) const
+        { return state == another.state && residual == another.residual; }
+      };
+
+      typedef std::vector<Element> Subset;
+
+      struct SubsetHash
+      {
+        size_t operator() (const Subset &subset) const
+        {
+          size_t h = subset.size();
+          for (Subset::const_iterator it = subset.begin();
+               it != subset.end(); ++it)
+            {
+              h = h * 1000003 ^ it->state;
+              h = h * 1000003 ^ std::hash<float>()(it->residual);
+            }
+          return h;
+        }
+      };
+
+      typedef std::unordered_map<Subset, HfstState, SubsetHash> SubsetMap;
+
+      static const HfstState NO_STATE = static_cast<HfstState>(-1);
+      static const size_t CHUNK_SIZE = 16;
+
+      struct Candidate
+      {
+        unsigned int input;
+        unsigned int output;
+        HfstState target;
+        float weight;
+      };
+
+      struct PendingArc
+      {
+        unsigned int input;
+        unsigned int output;
+        float weight;
+        Subset target;
+        HfstState target_number;
+      };
+
+      struct Expansion
+      {
+        std::vector<PendingArc> arcs;
+        bool final;
+        float final_weight;
+      };
+
+      struct ResultArc
+      {
+        unsigned int input;
+        unsigned int output;
+        float weight;
+        HfstState target;
+      };
+
+      HfstFrozenTransducer fsm;
+      std::string name;
+      float delta;
+      unsigned int thread_count;
+      unsigned int epsilon;
+
+      std::vector<Subset> subsets;
+      SubsetMap subset_ids;
+      std::vector<std::vector<ResultArc> > result_arcs;
+      std::vector<bool> result_final;
+      std::vector<float> result_final_weights;
+
+      float quantize(float w) const
+      {
+        if (delta <= 0.0 || std::isinf(w))
+          { return w; }
+        return std::floor(w / delta + 0.5) * delta;
+      }
+
+      bool is_epsilon_arc(const HfstFrozenTransducer::Arc &arc) const
+      { return arc.input == epsilon && arc.output == epsilon; }
+
+      // Add the epsilon:epsilon closure to subset, with the cheapest
+      // residual for each state, and sort it by state
+      void close(Subset &subset) const
+      {
+        std::unordered_map<HfstState, float> best;
+        std::vector<HfstState> queue;
+        for (Subset::const_iterator it = subset.begin(); it != subset.end();
+             ++it)
+          {
+            std::unordered_map<HfstState, float>::iterator b =
+              best.find(it->state);
+            if (b == best.end() || it->residual < b->second)
+              {
+                best[it->state] = it->residual;
+                queue.push_back(it->state);
+              }
+          }
+        for (size_t i = 0; i < queue.size(); ++i)
+          {
+            HfstState s = queue[i];
+            float residual = best[s];
+            std::pair<HfstFrozenTransducer::const_iterator,
+                      HfstFrozenTransducer::const_iterator> range =
+              fsm.arcs_with_input(s, epsilon);
+            for (HfstFrozenTransducer::const_iterator it = range.first;
+                 it != range.second; ++it)
+              {
+                if (!is_epsilon_arc(*it))
+                  { continue; }
+                float w = residual + it->weight;
+                std::unordered_map<HfstState, float>::iterator b =
+                  best.find(it->target);
+                if (b == best.end() || w < b->second)
+                  {
+                    best[it->target] = w;
+                    queue.push_back(it->target);
+                  }
+              }
+          }
+        subset.clear();
+        for (std::unordered_map<HfstState, float>::const_iterator it =
+               best.begin(); it != best.end(); ++it)
+          { subset.push_back(Element(it->first, it->second)); }
+        std::sort(subset.begin(), subset.end(),
+                  [](const Element &e1, const Element &e2)
+                  { return e1.state < e2.state; });
+      }
+
+      HfstState find_subset(const Subset &subset) const
+      {
+        SubsetMap::const_iterator it = subset_ids.find(subset);
+        if (it == subset_ids.end())
+          { return NO_STATE; }
+        return it->second;
+      }
+
+      HfstState add_subset(const Subset &subset)
+      {
+        HfstState id = subsets.size();
+        subsets.push_back(subset);
+        subset_ids[subset] = id;
+        result_arcs.push_back(std::vector<ResultArc>());
+        result_final.push_back(false);
+        result_final_weights.push_back(0.0);
+        return id;
+      }
+
+      void expand(const Subset &subset, Expansion &expansion) const
+      {
+        expansion.arcs.clear();
+        expansion.final = false;
+        expansion.final_weight = 0.0;
+        std::vector<Candidate> candidates;
+        for (Subset::const_iterator it = subset.begin(); it != subset.end();
+             ++it)
+          {
+            if (fsm.is_final_state(it->state))
+              {
+                float w = it->residual + fsm.get_final_weight(it->state);
+                if (!expansion.final || w < expansion.final_weight)
+                  {
+                    expansion.final = true;
+                    expansion.final_weight = w;
+                  }
+              }
+            for (HfstFrozenTransducer::const_iterator arc =
+                   fsm.begin(it->state); arc != fsm.end(it->state); ++arc)
+              {
+                if (is_epsilon_arc(*arc))
+                  { continue; }
+                Candidate c = { arc->input, arc->output, arc->target,
+                                it->residual + arc->weight };
+                candidates.push_back(c);
+              }
+          }
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const Candidate &c1, const Candidate &c2)
+                  {
+                    if (c1.input != c2.input)
+                      { return c1.input < c2.input; }
+                    if (c1.output != c2.output)
+                      { return c1.output < c2.output; }
+                    if (c1.target != c2.target)
+                      { return c1.target < c2.target; }
+                    return c1.weight < c2.weight;
+                  });
+        std::vector<Candidate>::const_iterator run_start = candidates.begin();
+        while (run_start != candidates.end())
+          {
+            std::vector<Candidate>::const_iterator run_end = run_start;
+            Subset target;
+            while (run_end != candidates.end() &&
+                   run_end->input == run_start->input &&
+                   run_end->output == run_start->output)
+              {
+                // Sorted by weight within a target, so the first is cheapest
+                if (target.empty() || target.back().state != run_end->target)
+                  { target.push_back(Element(run_end->target, run_end->weight)); }
+                ++run_end;
+              }
+            close(target);
+            float weight = target.front().residual;
+            for (Subset::iterator it = target.begin(); it != target.end();
+                 ++it)
+              { weight = std::min(weight, it->residual); }
+            for (Subset::iterator it = target.begin(); it != target.end();
+                 ++it)
+              { it->residual = quantize(it->residual - weight); }
+            PendingArc arc = { run_start->input, run_start->output, weight,
+                               target, find_subset(target) };
+            expansion.arcs.push_back(arc);
+            run_start = run_end;
+          }
+      }
+
+      void expand_level(const std::vector<HfstState> &level,
+                        std::vector<Expansion> &expansions)
+      {
+        expansions.resize(level.size());
+        std::atomic<size_t> cursor(0);
+        auto work = [this, &level, &expansions, &cursor]()
+          {
+            for (;;)
+              {
+                size_t begin = cursor.fetch_add(CHUNK_SIZE);
+                if (begin >= level.size())
+                  { break; }
+                size_t end = std::min(begin + CHUNK_SIZE, level.size());
+                for (size_t i = begin; i < end; ++i)
+                  { expand(subsets[level[i]], expansions[i]); }
+              }
+          };
+        size_t worker_count =
+          std::min<size_t>(thread_count,
+                           (level.size() + CHUNK_SIZE - 1) / CHUNK_SIZE);
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < worker_count; ++i)
+          { workers.push_back(std::thread(work)); }
+        work();
+        for (size_t i = 0; i < workers.size(); ++i)
+          { workers[i].join(); }
+      }
+
+      void number_level(const std::vector<HfstState> &level,
+                        std::vector<Expansion> &expansions,
+                        std::vector<HfstState> &next_level)
+      {
+        next_level.clear();
+        for (size_t i = 0; i < level.size(); ++i)
+          {
+            HfstState source = level[i];
+            Expansion &expansion = expansions[i];
+            result_final[source] = expansion.final;
+            result_final_weights[source] = expansion.final_weight;
+            for (std::vector<PendingArc>::const_iterator it =
+                   expansion.arcs.begin(); it != expansion.arcs.end(); ++it)
+              {
+                HfstState target = it->target_number;
+                if (target == NO_STATE)
+                  {
+                    // Not known when the level was expanded; it may have
+                    // been numbered earlier in this pass
+                    target = find_subset(it->target);
+                    if (target == NO_STATE)
+                      {
+                        target = add_subset(it->target);
+                        next_level.push_back(target);
+                      }
+                  }
+                ResultArc arc = { it->input, it->output, it->weight, target };
+                result_arcs[source].push_back(arc);
+              }
+            std::vector<PendingArc>().swap(expansion.arcs);
+          }
+      }
+    };
+
+  }
+}
+
+#endif // #ifndef _HFST_DETERMINIZER_H_
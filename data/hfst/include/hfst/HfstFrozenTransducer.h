@@ -0,0 +1,505 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+#ifndef _HFST_FROZEN_TRANSDUCER_H_
+#define _HFST_FROZEN_TRANSDUCER_H_
+
+/** @file HfstFrozenTransducer.h
+    @brief Class HfstFrozenTransducer */
+
+#include <vector>
+#include <set>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "HfstBasicTransducer.h"
+
+namespace hfst {
+  namespace implementations {
+
+    /** @brief An immutable, compact form of an HfstBasicTransducer.
+
+        All transitions are kept in one array, grouped by source state and
+        sorted by input symbol within each state, with an offset array
+        giving the first transition of each state (compressed sparse row
+        form). Symbols are the numbers HfstBasicTransition uses internally,
+        and final weights are kept in dense arrays. A transducer frozen this
+        way needs no allocation per state and sixteen bytes per transition.
+
+        Read-only algorithms run directly on the frozen form. To modify the
+        transducer, convert it back with to_basic_transducer().
+
+        State numbers are checked once, when the transducer is frozen. The
+        accessors that take a state do not check it again, because the
+        algorithms call them in their inner loops: a state passed to them
+        must be less than state_count(), as the start state 0 and the
+        target of every transition are. */
+    class HfstFrozenTransducer
+    {
+    public:
+      /** @brief A transition, without its source state. */
+      struct Arc
+      {
+        unsigned int input;
+        unsigned int output;
+        HfstState target;
+        float weight;
+      };
+
+      typedef const Arc * const_iterator;
+
+      /** @brief Freeze \a t. Transitions keep their relative order within
+          each input symbol.
+
+          @throws StateIndexOutOfBoundsException if a transition of \a t
+          leads to a state greater than its get_max_state(). */
+      HfstFrozenTransducer(const HfstBasicTransducer &t):
+        name(t.name)
+      {
+        HfstState state_count = t.get_max_state() + 1;
+        offsets.reserve(state_count + 1);
+        finality.assign(state_count, false);
+        final_weights.assign(state_count, 0.0);
+        size_t arc_count = 0;
+        for (HfstState s = 0; s < state_count; ++s)
+          { arc_count += t.transitions(s).size(); }
+        arcs.reserve(arc_count);
+        for (HfstState s = 0; s < state_count; ++s)
+          {
+            offsets.push_back(arcs.size());
+            const HfstBasicTransitions &transitions = t.transitions(s);
+            for (HfstBasicTransitions::const_iterator it = transitions.begin();
+                 it != transitions.end(); ++it)
+              {
+                if (it->get_target_state() >= state_count)
+                  { HFST_THROW(StateIndexOutOfBoundsException); }
+                Arc arc = { it->get_input_number(), it->get_output_number(),
+                            it->get_target_state(), it->get_weight() };
+                arcs.push_back(arc);
+              }
+            std::stable_sort(arcs.begin() + offsets.back(), arcs.end(),
+                             [](const Arc &a1, const Arc &a2)
+                             { return a1.input < a2.input; });
+            if (t.is_final_state(s))
+              {
+                finality[s] = true;
+                final_weights[s] = t.get_final_weight(s);
+              }
+          }
+        offsets.push_back(arcs.size());
+        const HfstBasicTransducer::HfstAlphabet &alpha = t.get_alphabet();
+        for (HfstBasicTransducer::HfstAlphabet::const_iterator it =
+               alpha.begin(); it != alpha.end(); ++it)
+          { alphabet.push_back(symbol_number(*it)); }
+        std::sort(alphabet.begin(), alphabet.end());
+        epsilon_number = symbol_number(internal_epsilon);
+        unknown_number = symbol_number(internal_unknown);
+        identity_number = symbol_number(internal_identity);
+        for (std::vector<Arc>::const_iterator it = arcs.begin();
+             it != arcs.end(); ++it)
+          {
+            if (epsilon_like_symbols.size() <= it->input)
+              { epsilon_like_symbols.resize(it->input + 1, 2); }
+            char &known = epsilon_like_symbols[it->input];
+            if (known == 2)
+              {
+                known = (it->input == epsilon_number ||
+                         FdOperation::is_diacritic(symbol_name(it->input)))
+                  ? 1 : 0;
+              }
+          }
+      }
+
+      /** @brief Thaw into a mutable HfstBasicTransducer. */
+      HfstBasicTransducer to_basic_transducer() const
+      {
+        HfstBasicTransducer retval;
+        retval.name = name;
+        HfstBasicTransducer::HfstAlphabet alpha;
+        for (std::vector<unsigned int>::const_iterator it = alphabet.begin();
+             it != alphabet.end(); ++it)
+          { alpha.insert(symbol_name(*it)); }
+        retval.add_symbols_to_alphabet(alpha);
+        if (state_count() > 1)
+          { retval.add_state(state_count() - 1); }
+        for (HfstState s = 0; s < state_count(); ++s)
+          {
+            HfstBasicTransitions &transitions = retval.transitions(s);
+            transitions.reserve(offsets[s + 1] - offsets[s]);
+            for (const_iterator it = begin(s); it != end(s); ++it)
+              {
+                transitions.push_back
+                  (HfstBasicTransition(it->target, it->input, it->output,
+                                       it->weight, false));
+              }
+            if (finality[s])
+              { retval.set_final_weight(s, final_weights[s]); }
+          }
+        return retval;
+      }
+
+      const std::string &get_name() const
+      { return name; }
+
+      /** @brief The number of states. */
+      HfstState state_count() const
+      { return final_weights.size(); }
+
+      /** @brief The number of transitions. */
+      size_t arc_count() const
+      { return arcs.size(); }
+
+      /** @brief The transitions leaving state \a s. */
+      const_iterator begin(HfstState s) const
+      { return arcs.data() + offsets[s]; }
+
+      const_iterator end(HfstState s) const
+      { return arcs.data() + offsets[s + 1]; }
+
+      /** @brief The transitions leaving state \a s with input \a symbol. */
+      std::pair<const_iterator, const_iterator>
+      arcs_with_input(HfstState s, unsigned int symbol) const
+      {
+        Arc key = { symbol, 0, 0, 0.0 };
+        return std::equal_range(begin(s), end(s), key,
+                                [](const Arc &a1, const Arc &a2)
+                                { return a1.input < a2.input; });
+      }
+
+      bool is_final_state(HfstState s) const
+      { return finality[s]; }
+
+      float get_final_weight(HfstState s) const
+      {
+        if (!finality[s])
+          { HFST_THROW(StateIsNotFinalException); }
+        return final_weights[s];
+      }
+
+      /** @brief Symbol numbers of the alphabet, in ascending order. */
+      const std::vector<unsigned int> &get_alphabet() const
+      { return alphabet; }
+
+      bool has_symbol(unsigned int symbol) const
+      { return std::binary_search(alphabet.begin(), alphabet.end(), symbol); }
+
+      static const std::string &symbol_name(unsigned int number)
+      { return HfstTropicalTransducerTransitionData::get_symbol(number); }
+
+      static unsigned int symbol_number(const std::string &symbol)
+      { return HfstTropicalTransducerTransitionData::get_number(symbol); }
+
+      /** @brief Whether transitions with input \a symbol are taken without
+          consuming input: epsilons and flag diacritics. Only defined for
+          input symbols of transitions. */
+      bool is_epsilon_like(unsigned int symbol) const
+      { return epsilon_like_symbols[symbol] == 1; }
+
+      /** @brief Sort the reachable states by their distance from the
+          start state, as HfstBasicTransducer::topsort(). With
+          MaximumDistance the reachable part must be acyclic. */
+      std::vector<std::set<HfstState> > topsort
+      (HfstBasicTransducer::SortDistance dist) const
+      {
+        const unsigned int unseen = std::numeric_limits<unsigned int>::max();
+        std::vector<unsigned int> distance(state_count(), unseen);
+        std::vector<HfstState> queue(1, 0);
+        distance[0] = 0;
+        if (dist == HfstBasicTransducer::MinimumDistance)
+          {
+            for (size_t i = 0; i < queue.size(); ++i)
+              {
+                HfstState s = queue[i];
+                for (const_iterator it = begin(s); it != end(s); ++it)
+                  {
+                    if (distance[it->target] == unseen)
+                      {
+                        distance[it->target] = distance[s] + 1;
+                        queue.push_back(it->target);
+                      }
+                  }
+              }
+          }
+        else
+          {
+            // Longest distances in topological order (Kahn's algorithm)
+            std::vector<bool> reachable(state_count(), false);
+            std::vector<unsigned int> in_degree(state_count(), 0);
+            reachable[0] = true;
+            for (size_t i = 0; i < queue.size(); ++i)
+              {
+                for (const_iterator it = begin(queue[i]); it != end(queue[i]);
+                     ++it)
+                  {
+                    ++in_degree[it->target];
+                    if (!reachable[it->target])
+                      {
+                        reachable[it->target] = true;
+                        queue.push_back(it->target);
+                      }
+                  }
+              }
+            size_t reachable_count = queue.size();
+            if (in_degree[0] != 0)
+              { HFST_THROW(TransducerIsCyclicException); }
+            queue.assign(1, 0);
+            for (size_t i = 0; i < queue.size(); ++i)
+              {
+                HfstState s = queue[i];
+                for (const_iterator it = begin(s); it != end(s); ++it)
+                  {
+                    if (distance[it->target] == unseen ||
+                        distance[it->target] < distance[s] + 1)
+                      { distance[it->target] = distance[s] + 1; }
+                    if (--in_degree[it->target] == 0)
+                      { queue.push_back(it->target); }
+                  }
+              }
+            if (queue.size() != reachable_count)
+              { HFST_THROW(TransducerIsCyclicException); }
+          }
+        std::vector<std::set<HfstState> > retval;
+        for (HfstState s = 0; s < state_count(); ++s)
+          {
+            if (distance[s] == unseen)
+              { continue; }
+            if (retval.size() <= distance[s])
+              { retval.resize(distance[s] + 1); }
+            retval[distance[s]].insert(s);
+          }
+        return retval;
+      }
+
+      /** @brief The length of the longest accepted path, counting every
+          transition, or -1 if nothing is accepted. */
+      int longest_path_size() const
+      {
+        std::vector<std::set<HfstState> > sorted = topsort(HfstBasicTransducer::MaximumDistance);
+        for (int i = static_cast<int>(sorted.size()) - 1; i >= 0; --i)
+          {
+            for (std::set<HfstState>::const_iterator it = sorted[i].begin();
+                 it != sorted[i].end(); ++it)
+              {
+                if (finality[*it])
+                  { return i; }
+              }
+          }
+        return -1;
+      }
+
+      /** @brief The maximum distances of the final states, in descending
+          order, as HfstBasicTransducer::path_sizes(). */
+      std::vector<unsigned int> path_sizes() const
+      {
+        std::vector<unsigned int> retval;
+        std::vector<std::set<HfstState> > sorted = topsort(HfstBasicTransducer::MaximumDistance);
+        for (int i = static_cast<int>(sorted.size()) - 1; i >= 0; --i)
+          {
+            for (std::set<HfstState>::const_iterator it = sorted[i].begin();
+                 it != sorted[i].end(); ++it)
+              {
+                if (finality[*it])
+                  {
+                    retval.push_back(i);
+                    break;
+                  }
+              }
+          }
+        return retval;
+      }
+
+      /** @brief Whether a state reachable from the start state is on a
+          cycle of transitions whose inputs are epsilons or flag
+          diacritics. */
+      bool is_infinitely_ambiguous() const
+      {
+        // 0 = not visited, 1 = on the current path, 2 = done. Every state
+        // reachable from the start state is visited: the epsilon-like
+        // transitions are followed depth-first, and the targets of the
+        // others are put on the agenda as new roots.
+        std::vector<char> colour(state_count(), 0);
+        std::vector<HfstState> agenda(1, 0);
+        std::vector<std::pair<HfstState, const Arc *> > stack;
+        while (!agenda.empty())
+          {
+            HfstState root = agenda.back();
+            agenda.pop_back();
+            if (colour[root] != 0)
+              { continue; }
+            colour[root] = 1;
+            stack.push_back(std::make_pair(root, begin(root)));
+            while (!stack.empty())
+              {
+                HfstState s = stack.back().first;
+                const Arc * &it = stack.back().second;
+                while (it != end(s) && !is_epsilon_like(it->input))
+                  {
+                    if (colour[it->target] == 0)
+                      { agenda.push_back(it->target); }
+                    ++it;
+                  }
+                if (it == end(s))
+                  {
+                    colour[s] = 2;
+                    stack.pop_back();
+                    continue;
+                  }
+                HfstState target = (it++)->target;
+                if (colour[target] == 1)
+                  { return true; }
+                if (colour[target] == 0)
+                  {
+                    colour[target] = 1;
+                    stack.push_back(std::make_pair(target, begin(target)));
+                  }
+              }
+          }
+        return false;
+      }
+
+      /** @brief Look up \a lookup_path, adding the paths that accept it to
+          \a results. Epsilon and flag diacritic transitions are followed
+          without consuming input; flags are not obeyed. Symbols outside
+          the alphabet match identity and unknown transitions.
+
+          A state may be revisited at the same input position at most
+          \a max_epsilon_cycles times on one path (zero if NULL). Paths
+          heavier than \a max_weight are dropped, and at most
+          \a max_number results are collected if it is not negative. */
+      void lookup(const StringVector &lookup_path,
+                  HfstTwoLevelPaths &results,
+                  size_t * max_epsilon_cycles = NULL,
+                  float * max_weight = NULL,
+                  int max_number = -1) const
+      {
+        Lookup l(results);
+        l.max_cycles = max_epsilon_cycles == NULL ? 0 : *max_epsilon_cycles;
+        l.max_weight = max_weight;
+        l.max_number = max_number;
+        for (StringVector::const_iterator it = lookup_path.begin();
+             it != lookup_path.end(); ++it)
+          {
+            unsigned int number =
+              HfstTropicalTransducerTransitionData::symbol2number_map.count
+              (*it) == 0 ? NOT_IN_ALPHABET : symbol_number(*it);
+            if (number != NOT_IN_ALPHABET && !has_symbol(number))
+              { number = NOT_IN_ALPHABET; }
+            l.input.push_back(number);
+          }
+        l.input_strings = &lookup_path;
+        lookup(l, 0, 0, 0.0);
+      }
+
+    protected:
+      static const unsigned int NOT_IN_ALPHABET =
+        std::numeric_limits<unsigned int>::max();
+
+      struct Lookup
+      {
+        std::vector<unsigned int> input;
+        const StringVector * input_strings;
+        HfstTwoLevelPaths &results;
+        StringPairVector path;
+        // Times each (input position, state) is on the current path
+        std::unordered_map<uint64_t, size_t> visits;
+        size_t max_cycles;
+        float * max_weight;
+        int max_number;
+        Lookup(HfstTwoLevelPaths &r): input_strings(NULL), results(r),
+          max_cycles(0), max_weight(NULL), max_number(-1) {}
+      };
+
+      void take(Lookup &l, const Arc &arc, size_t index, float weight,
+                const std::string &input, const std::string &output) const
+      {
+        l.path.push_back(StringPair(input, output));
+        lookup(l, arc.target, index, weight + arc.weight);
+        l.path.pop_back();
+      }
+
+      void lookup(Lookup &l, HfstState s, size_t index, float weight) const
+      {
+        if (l.max_number >= 0 &&
+            l.results.size() >= static_cast<size_t>(l.max_number))
+          { return; }
+        if (l.max_weight != NULL && weight > *l.max_weight)
+          { return; }
+        size_t &visits = l.visits[(static_cast<uint64_t>(index) << 32) | s];
+        if (visits > l.max_cycles)
+          { return; }
+        ++visits;
+        if (index == l.input.size() && finality[s])
+          {
+            float total = weight + final_weights[s];
+            if (l.max_weight == NULL || total <= *l.max_weight)
+              { l.results.insert(HfstTwoLevelPath(total, l.path)); }
+          }
+        if (index < l.input.size())
+          {
+            unsigned int symbol = l.input[index];
+            const std::string &symbol_string = (*l.input_strings)[index];
+            if (symbol != NOT_IN_ALPHABET)
+              {
+                std::pair<const_iterator, const_iterator> range =
+                  arcs_with_input(s, symbol);
+                for (const_iterator it = range.first; it != range.second; ++it)
+                  {
+                    take(l, *it, index + 1, weight, symbol_string,
+                         symbol_name(it->output));
+                  }
+              }
+            else
+              {
+                unsigned int specials[2] = { unknown_number, identity_number };
+                for (int i = 0; i < 2; ++i)
+                  {
+                    std::pair<const_iterator, const_iterator> range =
+                      arcs_with_input(s, specials[i]);
+                    for (const_iterator it = range.first; it != range.second;
+                         ++it)
+                      {
+                        take(l, *it, index + 1, weight, symbol_string,
+                             it->output == identity_number ? symbol_string
+                             : symbol_name(it->output));
+                      }
+                  }
+              }
+          }
+        for (const_iterator it = begin(s); it != end(s); ++it)
+          {
+            if (is_epsilon_like(it->input))
+              {
+                take(l, *it, index, weight, symbol_name(it->input),
+                     symbol_name(it->output));
+              }
+          }
+        --l.visits[(static_cast<uint64_t>(index) << 32) | s];
+      }
+
+      std::string name;
+      std::vector<size_t> offsets;
+      std::vector<Arc> arcs;
+      std::vector<bool> finality;
+      std::vector<float> final_weights;
+      std::vector<unsigned int> alphabet;
+      unsigned int epsilon_number;
+      unsigned int unknown_number;
+      unsigned int identity_number;
+      // Per input symbol number: 1 if epsilon-like, 0 if not, 2 if unused
+      std::vector<char> epsilon_like_symbols;
+    };
+
+  }
+}
+
+#endif // #ifndef _HFST_FROZEN_TRANSDUCER_H_
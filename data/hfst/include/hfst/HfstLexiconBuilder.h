@@ -0,0 +1,282 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+#ifndef _HFST_LEXICON_BUILDER_H_
+#define _HFST_LEXICON_BUILDER_H_
+
+/** @file HfstLexiconBuilder.h
+    @brief Class HfstLexiconBuilder */
+
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <stdint.h>
+
+#include "HfstFrozenTransducer.h"
+
+namespace hfst {
+  namespace implementations {
+
+    /** @brief Build a minimal acyclic transducer from entries given in
+        sorted order, as in the incremental algorithm of Daciuk et al.
+
+        An entry is a StringPairVector with a weight, which becomes the
+        final weight of the path. Entries must come in ascending
+        lexicographic order of their pairs, compared as strings, which is
+        the order in which a std::set<StringPairVector>, or a std::map from
+        StringPairVector to weight, iterates over them. An entry that is
+        equal to the previous one only lowers its weight to the smaller of
+        the two.
+
+        Only the states of the previous entry that are not shared with the
+        new one can still change. When a new entry is added, those states
+        are replaced with an equivalent state from a register of finished
+        states if one exists and registered otherwise, so the states kept
+        are those of the minimal transducer plus the current path. States
+        that are replaced are reused for later entries.
+
+        @code
+        std::set<StringPairVector> entries;
+        // ... fill entries ...
+        HfstLexiconBuilder builder;
+        for (std::set<StringPairVector>::const_iterator it = entries.begin();
+             it != entries.end(); ++it)
+          { builder.add(*it); }
+        HfstBasicTransducer lexicon = builder.finish();
+        @endcode */
+    class HfstLexiconBuilder
+    {
+    public:
+      HfstLexiconBuilder():
+        register_(0, StateHash(states), StateEqual(states))
+      { clear(); }
+
+      /** @brief Forget all entries. */
+      void clear()
+      {
+        states.assign(1, State());
+        free_states.clear();
+        register_.clear();
+        previous.clear();
+        path.assign(1, 0);
+        started = false;
+        symbols.clear();
+      }
+
+      /** @brief Add the entry \a entry with weight \a weight.
+
+          @throws HfstFatalException if \a entry precedes the previous
+          entry. */
+      void add(const StringPairVector &entry, float weight = 0.0)
+      {
+        labels.clear();
+        for (StringPairVector::const_iterator it = entry.begin();
+             it != entry.end(); ++it)
+          {
+            symbols.insert(it->first);
+            symbols.insert(it->second);
+            labels.push_back(encode(it->first, it->second));
+          }
+
+        size_t prefix = 0;
+        while (prefix < labels.size() && prefix < previous.size() &&
+               labels[prefix] == previous[prefix])
+          { ++prefix; }
+        if (started && prefix == labels.size() && prefix == previous.size())
+          {
+            State &last = states[path.back()];
+            last.weight = std::min(last.weight, weight);
+            return;
+          }
+        if (started &&
+            (prefix == labels.size() ||
+             (prefix < previous.size() &&
+              entry[prefix] < decode(previous[prefix]))))
+          {
+            HFST_THROW_MESSAGE(HfstFatalException,
+                               "HfstLexiconBuilder: entries are not sorted");
+          }
+
+        replace_or_register(prefix);
+        for (size_t i = prefix; i < labels.size(); ++i)
+          {
+            HfstState s = new_state();
+            states[path.back()].arcs.push_back(Arc(labels[i], s));
+            path.push_back(s);
+          }
+        State &last = states[path.back()];
+        last.final = true;
+        last.weight = weight;
+        previous.swap(labels);
+        started = true;
+      }
+
+      /** @brief Finish the transducer and return it. The builder is
+          cleared. */
+      HfstBasicTransducer finish()
+      {
+        replace_or_register(0);
+
+        HfstBasicTransducer retval;
+        HfstBasicTransducer::HfstAlphabet alphabet(symbols.begin(),
+                                                   symbols.end());
+        retval.add_symbols_to_alphabet(alphabet);
+        const HfstState unnumbered = static_cast<HfstState>(-1);
+        std::vector<HfstState> number(states.size(), unnumbered);
+        std::vector<HfstState> queue(1, 0);
+        number[0] = 0;
+        for (size_t i = 0; i < queue.size(); ++i)
+          {
+            const State &s = states[queue[i]];
+            for (std::vector<Arc>::const_iterator it = s.arcs.begin();
+                 it != s.arcs.end(); ++it)
+              {
+                if (number[it->second] == unnumbered)
+                  {
+                    number[it->second] = queue.size();
+                    queue.push_back(it->second);
+                  }
+              }
+          }
+        if (queue.size() > 1)
+          { retval.add_state(queue.size() - 1); }
+        for (size_t i = 0; i < queue.size(); ++i)
+          {
+            const State &s = states[queue[i]];
+            HfstBasicTransitions &transitions = retval.transitions(i);
+            transitions.reserve(s.arcs.size());
+            for (std::vector<Arc>::const_iterator it = s.arcs.begin();
+                 it != s.arcs.end(); ++it)
+              {
+                transitions.push_back
+                  (HfstBasicTransition(number[it->second],
+                                       it->first >> 32,
+                                       it->first & 0xffffffff,
+                                       0.0, false));
+              }
+            if (s.final)
+              { retval.set_final_weight(i, s.weight); }
+          }
+        clear();
+        return retval;
+      }
+
+      /** @brief The number of states in use, including the states of the
+          last entry that are not registered yet. */
+      size_t state_count() const
+      { return states.size() - free_states.size(); }
+
+      HfstLexiconBuilder(const HfstLexiconBuilder &) = delete;
+      HfstLexiconBuilder &operator=(const HfstLexiconBuilder &) = delete;
+
+    protected:
+      // A symbol pair, input number in the high half
+      typedef uint64_t Label;
+      typedef std::pair<Label, HfstState> Arc;
+
+      struct State
+      {
+        std::vector<Arc> arcs;
+        bool final;
+        float weight;
+        State(): final(false), weight(0.0) {}
+      };
+
+      struct StateHash
+      {
+        const std::vector<State> &states;
+        StateHash(const std::vector<State> &states): states(states) {}
+        size_t operator() (HfstState s) const
+        {
+          const State &state = states[s];
+          size_t h = state.final ? std::hash<float>()(state.weight) + 1 : 0;
+          for (std::vector<Arc>::const_iterator it = state.arcs.begin();
+               it != state.arcs.end(); ++it)
+            {
+              h = h * 1000003 ^ std::hash<Label>()(it->first);
+              h = h * 1000003 ^ it->second;
+            }
+          return h;
+        }
+      };
+
+      struct StateEqual
+      {
+        const std::vector<State> &states;
+        StateEqual(const std::vector<State> &states): states(states) {}
+        bool operator() (HfstState s1, HfstState s2) const
+        {
+          const State &state1 = states[s1];
+          const State &state2 = states[s2];
+          return state1.final == state2.final &&
+            (!state1.final || state1.weight == state2.weight) &&
+            state1.arcs == state2.arcs;
+        }
+      };
+
+      std::vector<State> states;
+      std::vector<HfstState> free_states;
+      std::unordered_set<HfstState, StateHash, StateEqual> register_;
+      // Labels of the previous entry, and the states on its path
+      std::vector<Label> previous;
+      std::vector<HfstState> path;
+      bool started;
+      std::vector<Label> labels;
+      std::set<std::string> symbols;
+
+      static Label encode(const std::string &input, const std::string &output)
+      {
+        return (static_cast<Label>
+                (HfstFrozenTransducer::symbol_number(input)) << 32) |
+          HfstFrozenTransducer::symbol_number(output);
+      }
+
+      static StringPair decode(Label label)
+      {
+        return StringPair(HfstFrozenTransducer::symbol_name(label >> 32),
+                          HfstFrozenTransducer::symbol_name
+                          (label & 0xffffffff));
+      }
+
+      HfstState new_state()
+      {
+        if (free_states.empty())
+          {
+            states.push_back(State());
+            return states.size() - 1;
+          }
+        HfstState s = free_states.back();
+        free_states.pop_back();
+        return s;
+      }
+
+      // Replace or register the states of the previous path below depth
+      // \a depth, deepest first
+      void replace_or_register(size_t depth)
+      {
+        while (path.size() > depth + 1)
+          {
+            HfstState s = path.back();
+            path.pop_back();
+            std::pair<std::unordered_set<HfstState, StateHash, StateEqual>::
+                      iterator, bool> inserted = register_.insert(s);
+            if (!inserted.second)
+              {
+                states[path.back()].arcs.back().second = *inserted.first;
+                states[s] = State();
+                free_states.push_back(s);
+              }
+          }
+      }
+    };
+
+  }
+}
+
+#endif // #ifndef _HFST_LEXICON_BUILDER_H_
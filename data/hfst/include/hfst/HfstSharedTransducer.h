@@ -0,0 +1,141 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+#ifndef _HFST_SHARED_TRANSDUCER_H_
+#define _HFST_SHARED_TRANSDUCER_H_
+
+/** @file HfstSharedTransducer.h
+    @brief Class HfstSharedTransducer */
+
+#include <memory>
+#include <utility>
+
+#include "HfstTransducer.h"
+
+namespace hfst
+{
+
+  /** \brief A copy-on-write handle to an HfstTransducer.
+
+      Copies of a handle share one transducer, so copies that are only
+      read cost nothing. The transducer is copied when it is modified
+      through mutate() or one of the operations below while other handles
+      still share it.
+
+      A handle can be read from several threads at the same time, but a
+      handle that is modified must not be shared with other threads
+      without synchronization.
+
+\verbatim
+HfstSharedTransducer lexicon(HfstTransducer(...));
+HfstSharedTransducer with_rules = lexicon;   // no copy
+with_rules.compose(rules).minimize();       // copies the lexicon once
+\endverbatim
+  */
+  class HfstSharedTransducer
+  {
+  protected:
+    std::shared_ptr<HfstTransducer> transducer;
+
+  public:
+    /** \brief A handle to an uninitialized transducer. */
+    HfstSharedTransducer():
+      transducer(std::make_shared<HfstTransducer>()) {}
+
+    /** \brief A handle to a copy of \a t. */
+    explicit HfstSharedTransducer(const HfstTransducer &t):
+      transducer(std::make_shared<HfstTransducer>(t)) {}
+
+    /** \brief A handle that takes over \a t without copying it. */
+    explicit HfstSharedTransducer(HfstTransducer &&t):
+      transducer(std::make_shared<HfstTransducer>(std::move(t))) {}
+
+    /** \brief The transducer, for reading. */
+    const HfstTransducer &get() const { return *transducer; }
+
+    const HfstTransducer &operator*() const { return *transducer; }
+
+    const HfstTransducer *operator->() const { return transducer.get(); }
+
+    /** \brief Whether other handles share the transducer. */
+    bool is_shared() const { return transducer.use_count() > 1; }
+
+    /** \brief The transducer, for modification. It is copied first if
+        other handles share it. */
+    HfstTransducer &mutate()
+    {
+      if (is_shared())
+        { transducer = std::make_shared<HfstTransducer>(*transducer); }
+      return *transducer;
+    }
+
+    /** \brief Take the transducer out of the handle, copying it only if
+        other handles share it. The handle is left uninitialized. */
+    HfstTransducer release()
+    {
+      HfstTransducer retval;
+      if (is_shared())
+        { retval = *transducer; }
+      else
+        { retval = std::move(*transducer); }
+      transducer = std::make_shared<HfstTransducer>();
+      return retval;
+    }
+
+    /** \brief Compose with \a another. */
+    HfstSharedTransducer &compose(const HfstSharedTransducer &another,
+                                  bool harmonize=true)
+    {
+      mutate().compose(another.get(), harmonize);
+      return *this;
+    }
+
+    /** \brief Concatenate with \a another. */
+    HfstSharedTransducer &concatenate(const HfstSharedTransducer &another,
+                                      bool harmonize=true)
+    {
+      mutate().concatenate(another.get(), harmonize);
+      return *this;
+    }
+
+    /** \brief Disjunct with \a another. */
+    HfstSharedTransducer &disjunct(const HfstSharedTransducer &another,
+                                   bool harmonize=true)
+    {
+      mutate().disjunct(another.get(), harmonize);
+      return *this;
+    }
+
+    /** \brief Intersect with \a another. */
+    HfstSharedTransducer &intersect(const HfstSharedTransducer &another,
+                                    bool harmonize=true)
+    {
+      mutate().intersect(another.get(), harmonize);
+      return *this;
+    }
+
+    /** \brief Subtract \a another. */
+    HfstSharedTransducer &subtract(const HfstSharedTransducer &another,
+                                   bool harmonize=true)
+    {
+      mutate().subtract(another.get(), harmonize);
+      return *this;
+    }
+
+    /** \brief Minimize the transducer. */
+    HfstSharedTransducer &minimize()
+    {
+      mutate().minimize();
+      return *this;
+    }
+  };
+
+}
+
+#endif // #ifndef _HFST_SHARED_TRANSDUCER_H_
@@ -58,6 +58,7 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <utility>
 
 #include "hfstdll.h"
 
@@ -678,6 +679,42 @@ in \a ifile.
 
     HFSTDLL HfstTransducer &assign(const HfstTransducer &another);
 
+    /** \brief Create a transducer that takes over the backend
+        implementation of \a another without copying it.
+
+        \a another is left uninitialized, as if created with
+        HfstTransducer(), and can be given a new value by assignment. **/
+    HfstTransducer(HfstTransducer &&another):
+      HfstTransducer()
+    { swap(another); }
+
+    /** @brief Assign this transducer the value of \a another without
+        copying its backend implementation. \a another is left
+        uninitialized. */
+    HfstTransducer &operator=(HfstTransducer &&another)
+    { return assign(std::move(another)); }
+
+    HfstTransducer &assign(HfstTransducer &&another)
+    {
+      if (this != &another)
+        {
+          HfstTransducer taken(std::move(another));
+          swap(taken);
+        }
+      return *this;
+    }
+
+    /** @brief Exchange the values of this transducer and \a another. */
+    void swap(HfstTransducer &another)
+    {
+      std::swap(type, another.type);
+      std::swap(anonymous, another.anonymous);
+      std::swap(is_trie, another.is_trie);
+      name.swap(another.name);
+      props.swap(another.props);
+      std::swap(implementation, another.implementation);
+    }
+
     // ------------------------------------------------------------
     // ----------- Properties, comparison, conversion -------------
     // ------------------------------------------------------------
@@ -0,0 +1,290 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+#ifndef _HFST_LOOKUP_INDEX_H_
+#define _HFST_LOOKUP_INDEX_H_
+
+/** @file HfstLookupIndex.h
+    @brief Class HfstLookupIndex */
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <stdint.h>
+
+#include "HfstBasicTransducer.h"
+
+namespace hfst {
+  namespace implementations {
+
+    /** @brief Lookup on an HfstBasicTransducer that is still being
+        edited, through a per-state index of its transitions by input
+        symbol number.
+
+        The index of a state is built the first time lookup reaches the
+        state, so a transducer can be edited between lookups without
+        converting it to optimized-lookup format. Which edits are noticed
+        without help:
+
+        - adding states;
+        - adding or removing transitions of a state, when that changes
+          the number of its transitions or moves them in memory.
+
+        The number and the address of the transitions are all that is
+        checked. Other edits must be reported:
+
+        - a transition changed or replaced in place, or a removal and an
+          addition that leave the state with as many transitions as before
+          in the same storage: call invalidate(s) for the state;
+        - edits to many states: call new_generation(), which makes every
+          index stale in constant time.
+
+        Lookup builds indices as it goes, so one HfstLookupIndex must not
+        be used from several threads at the same time. */
+    class HfstLookupIndex
+    {
+    public:
+      /** @brief Index \a t, which must outlive the index. */
+      HfstLookupIndex(const HfstBasicTransducer &t):
+        fsm(t),
+        epsilon_number(HfstTropicalTransducerTransitionData::
+                       get_number(internal_epsilon)),
+        unknown_number(HfstTropicalTransducerTransitionData::
+                       get_number(internal_unknown)),
+        identity_number(HfstTropicalTransducerTransitionData::
+                        get_number(internal_identity)),
+        generation(0)
+      {}
+
+      /** @brief Forget the index of state \a s. */
+      void invalidate(HfstState s)
+      {
+        if (s < indices.size())
+          { indices[s].valid = false; }
+      }
+
+      /** @brief Forget the index of all states. */
+      void invalidate()
+      { indices.clear(); }
+
+      /** @brief Make the index of every state stale, without freeing the
+          memory of the indices. Call after editing the transducer in ways
+          that are not noticed. */
+      void new_generation()
+      { ++generation; }
+
+      /** @brief Look up \a lookup_path as HfstFrozenTransducer::lookup()
+          does: epsilon and flag diacritic transitions are followed without
+          consuming input and flags are not obeyed, and symbols outside the
+          alphabet match identity and unknown transitions.
+
+          A state may be revisited at the same input position at most
+          \a max_epsilon_cycles times on one path (zero if NULL). Paths
+          heavier than \a max_weight are dropped, and at most
+          \a max_number results are collected if it is not negative. */
+      void lookup(const StringVector &lookup_path,
+                  HfstTwoLevelPaths &results,
+                  size_t * max_epsilon_cycles = NULL,
+                  float * max_weight = NULL,
+                  int max_number = -1)
+      {
+        if (indices.size() < fsm.get_max_state() + 1)
+          { indices.resize(fsm.get_max_state() + 1); }
+        Lookup l(results, lookup_path);
+        l.max_cycles = max_epsilon_cycles == NULL ? 0 : *max_epsilon_cycles;
+        l.max_weight = max_weight;
+        l.max_number = max_number;
+        const HfstBasicTransducer::HfstAlphabet &alphabet =
+          fsm.get_alphabet();
+        for (StringVector::const_iterator it = lookup_path.begin();
+             it != lookup_path.end(); ++it)
+          {
+            l.input.push_back(alphabet.count(*it) == 0 ? NOT_IN_ALPHABET :
+                              HfstTropicalTransducerTransitionData::
+                              get_number(*it));
+          }
+        lookup(l, 0, 0, 0.0);
+      }
+
+    protected:
+      static const unsigned int NOT_IN_ALPHABET = static_cast<unsigned int>(-1);
+
+      struct StateIndex
+      {
+        const HfstBasicTransition * data;
+        size_t size;
+        uint64_t generation;
+        bool valid;
+        // Transitions by input symbol number, and the epsilon-like ones
+        std::vector<unsigned int> by_input;
+        std::vector<unsigned int> epsilon_like;
+        StateIndex(): data(NULL), size(0), generation(0), valid(false) {}
+      };
+
+      struct Lookup
+      {
+        HfstTwoLevelPaths &results;
+        const StringVector &input_strings;
+        std::vector<unsigned int> input;
+        StringPairVector path;
+        // Times each (input position, state) is on the current path
+        std::unordered_map<uint64_t, size_t> visits;
+        size_t max_cycles;
+        float * max_weight;
+        int max_number;
+        Lookup(HfstTwoLevelPaths &r, const StringVector &i):
+          results(r), input_strings(i), max_cycles(0), max_weight(NULL),
+          max_number(-1) {}
+      };
+
+      const HfstBasicTransducer &fsm;
+      unsigned int epsilon_number;
+      unsigned int unknown_number;
+      unsigned int identity_number;
+      std::vector<StateIndex> indices;
+      uint64_t generation;
+      // Per symbol number: 1 if epsilon-like, 0 if not, 2 if not known yet
+      std::vector<char> epsilon_like_symbols;
+
+      bool is_epsilon_like(unsigned int symbol)
+      {
+        if (epsilon_like_symbols.size() <= symbol)
+          { epsilon_like_symbols.resize(symbol + 1, 2); }
+        char &known = epsilon_like_symbols[symbol];
+        if (known == 2)
+          {
+            known = (symbol == epsilon_number ||
+                     FdOperation::is_diacritic
+                     (HfstTropicalTransducerTransitionData::
+                      get_symbol(symbol))) ? 1 : 0;
+          }
+        return known == 1;
+      }
+
+      // The index of state s, built or rebuilt if needed
+      const StateIndex &index_of(HfstState s,
+                                 const HfstBasicTransitions &transitions)
+      {
+        StateIndex &index = indices[s];
+        if (index.valid && index.generation == generation &&
+            index.data == transitions.data() &&
+            index.size == transitions.size())
+          { return index; }
+        index.data = transitions.data();
+        index.size = transitions.size();
+        index.generation = generation;
+        index.valid = true;
+        index.by_input.resize(transitions.size());
+        index.epsilon_like.clear();
+        for (unsigned int i = 0; i < transitions.size(); ++i)
+          {
+            index.by_input[i] = i;
+            if (is_epsilon_like(transitions[i].get_input_number()))
+              { index.epsilon_like.push_back(i); }
+          }
+        std::stable_sort(index.by_input.begin(), index.by_input.end(),
+                         [&transitions](unsigned int i1, unsigned int i2)
+                         {
+                           return transitions[i1].get_input_number() <
+                             transitions[i2].get_input_number();
+                         });
+        return index;
+      }
+
+      static std::pair<std::vector<unsigned int>::const_iterator,
+                       std::vector<unsigned int>::const_iterator>
+      with_input(const StateIndex &index,
+                 const HfstBasicTransitions &transitions,
+                 unsigned int symbol)
+      {
+        std::vector<unsigned int>::const_iterator first =
+          std::lower_bound(index.by_input.begin(), index.by_input.end(),
+                           symbol,
+                           [&transitions](unsigned int i, unsigned int sym)
+                           { return transitions[i].get_input_number() < sym; });
+        std::vector<unsigned int>::const_iterator last = first;
+        while (last != index.by_input.end() &&
+               transitions[*last].get_input_number() == symbol)
+          { ++last; }
+        return std::make_pair(first, last);
+      }
+
+      void take(Lookup &l, const HfstBasicTransition &transition,
+                size_t index, float weight, const std::string &input,
+                const std::string &output)
+      {
+        l.path.push_back(StringPair(input, output));
+        lookup(l, transition.get_target_state(), index,
+               weight + transition.get_weight());
+        l.path.pop_back();
+      }
+
+      void lookup(Lookup &l, HfstState s, size_t index, float weight)
+      {
+        if (l.max_number >= 0 &&
+            l.results.size() >= static_cast<size_t>(l.max_number))
+          { return; }
+        if (l.max_weight != NULL && weight > *l.max_weight)
+          { return; }
+        size_t &visits = l.visits[(static_cast<uint64_t>(index) << 32) | s];
+        if (visits > l.max_cycles)
+          { return; }
+        ++visits;
+        if (index == l.input.size() && fsm.is_final_state(s))
+          {
+            float total = weight + fsm.get_final_weight(s);
+            if (l.max_weight == NULL || total <= *l.max_weight)
+              { l.results.insert(HfstTwoLevelPath(total, l.path)); }
+          }
+        const HfstBasicTransitions &transitions = fsm.transitions(s);
+        const StateIndex &state_index = index_of(s, transitions);
+        if (index < l.input.size())
+          {
+            unsigned int symbol = l.input[index];
+            const std::string &symbol_string = l.input_strings[index];
+            unsigned int symbols[2] = { symbol, NOT_IN_ALPHABET };
+            if (symbol == NOT_IN_ALPHABET)
+              {
+                symbols[0] = unknown_number;
+                symbols[1] = identity_number;
+              }
+            for (int i = 0; i < 2 && symbols[i] != NOT_IN_ALPHABET; ++i)
+              {
+                std::pair<std::vector<unsigned int>::const_iterator,
+                          std::vector<unsigned int>::const_iterator> range =
+                  with_input(state_index, transitions, symbols[i]);
+                for (std::vector<unsigned int>::const_iterator it =
+                       range.first; it != range.second; ++it)
+                  {
+                    const HfstBasicTransition &tr = transitions[*it];
+                    unsigned int output = tr.get_output_number();
+                    take(l, tr, index + 1, weight, symbol_string,
+                         symbol == NOT_IN_ALPHABET &&
+                         output == identity_number ? symbol_string :
+                         HfstTropicalTransducerTransitionData::
+                         get_symbol(output));
+                  }
+              }
+          }
+        for (std::vector<unsigned int>::const_iterator it =
+               state_index.epsilon_like.begin();
+             it != state_index.epsilon_like.end(); ++it)
+          {
+            const HfstBasicTransition &tr = transitions[*it];
+            take(l, tr, index, weight, tr.get_input_symbol(),
+                 tr.get_output_symbol());
+          }
+        --l.visits[(static_cast<uint64_t>(index) << 32) | s];
+      }
+    };
+
+  }
+}
+
+#endif // #ifndef _HFST_LOOKUP_INDEX_H_
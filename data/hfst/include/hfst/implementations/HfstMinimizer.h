@@ -0,0 +1,478 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+#ifndef _HFST_MINIMIZER_H_
+#define _HFST_MINIMIZER_H_
+
+/** @file HfstMinimizer.h
+    @brief Class HfstMinimizer */
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+
+#include "HfstFrozenTransducer.h"
+
+namespace hfst {
+  namespace implementations {
+
+    /** @brief Partition-refinement minimization of a deterministic
+        transducer, with splitters processed by several threads.
+
+        The transducer is treated as an acceptor over labels made of the
+        input symbol, the output symbol and the weight of a transition, as
+        when weights are encoded into the labels. Final states start in
+        blocks of their own by final weight. The transducer must be
+        deterministic over symbol pairs, as the output of HfstDeterminizer
+        is; weights are not pushed, so they should be pushed beforehand for
+        the smallest result.
+
+        The refinement is that of Valmari and Lehtinen for partial
+        transition functions: every initial block is a splitter, and when a
+        block is split, the smaller half becomes a splitter. Incoming
+        transitions are kept in a label-sorted compressed sparse row
+        array. Splitters are taken from the agenda in batches of up to four
+        per thread; the predecessors of each splitter in a batch are
+        gathered by worker threads against the same partition, and the
+        splits are then made in batch order by one thread. A batch gets as
+        many threads as its incoming transitions are worth. The result does
+        not depend on the number of threads. */
+    class HfstMinimizer
+    {
+    public:
+      /** @brief Prepare to minimize \a t, which must outlive the
+          minimizer, with \a threads threads, or one per hardware thread if
+          zero. Weights that differ by less than \a delta are treated as
+          equal. */
+      HfstMinimizer(const HfstFrozenTransducer &t,
+                    unsigned int threads = 0,
+                    float delta = 1.0 / 1024):
+        fsm(t), delta(delta), thread_count(threads), refine_workers(0)
+      {
+        if (thread_count == 0)
+          {
+            thread_count =
+              std::max(1u, std::thread::hardware_concurrency());
+          }
+      }
+
+      /** @brief Minimize \a t with \a threads threads. */
+      static HfstBasicTransducer minimize(const HfstBasicTransducer &t,
+                                          unsigned int threads = 0)
+      {
+        HfstFrozenTransducer frozen(t);
+        HfstMinimizer minimizer(frozen, threads);
+        return minimizer.minimize();
+      }
+
+      /** @brief The minimized transducer, restricted to the states
+          reachable from the start state and numbered breadth-first. */
+      HfstBasicTransducer minimize()
+      {
+        encode_labels();
+        build_incoming();
+        init_partition();
+        refine();
+        return quotient();
+      }
+
+      /** @brief The number of blocks after the last minimize(). */
+      size_t block_count() const
+      { return block_begin.size(); }
+
+      /** @brief The largest number of threads that gathered the
+          predecessors of one batch of splitters in the last minimize(). */
+      size_t refine_thread_count() const
+      { return refine_workers; }
+
+    protected:
+      struct Label
+      {
+        unsigned int input;
+        unsigned int output;
+        float weight;
+        bool operator==(const Label &another) const
+        {
+          return input == another.input && output == another.output &&
+            weight == another.weight;
+        }
+      };
+
+      struct LabelHash
+      {
+        size_t operator() (const Label &l) const
+        {
+          size_t h = l.input;
+          h = h * 1000003 ^ l.output;
+          return h * 1000003 ^ std::hash<float>()(l.weight);
+        }
+      };
+
+      struct InArc
+      {
+        unsigned int label;
+        HfstState source;
+        bool operator<(const InArc &another) const
+        {
+          if (label != another.label)
+            { return label < another.label; }
+          return source < another.source;
+        }
+        bool operator==(const InArc &another) const
+        { return label == another.label && source == another.source; }
+      };
+
+      static const size_t CHUNK_SIZE = 256;
+      // Incoming transitions worth a thread of their own in refine()
+      static const size_t MIN_ARCS_PER_THREAD = 1024;
+
+      const HfstFrozenTransducer &fsm;
+      float delta;
+      unsigned int thread_count;
+      size_t refine_workers;
+
+      // Label of each transition, by its index in the frozen transducer
+      std::vector<unsigned int> arc_labels;
+      std::vector<size_t> in_offsets;
+      std::vector<InArc> in_arcs;
+
+      // The refinable partition: the states of a block are
+      // elements[block_begin[b]..block_end[b]), marked ones first
+      std::vector<HfstState> elements;
+      std::vector<size_t> location;
+      std::vector<unsigned int> block_of;
+      std::vector<size_t> block_begin;
+      std::vector<size_t> block_end;
+      std::vector<size_t> block_marked;
+      std::vector<unsigned int> touched;
+      std::vector<unsigned int> agenda;
+
+      float quantize(float w) const
+      {
+        if (delta <= 0.0 || std::isinf(w))
+          { return w; }
+        return std::floor(w / delta + 0.5) * delta;
+      }
+
+      // Call f(i) for 0 <= i < n on worker_count threads, which take
+      // chunk_size indices at a time
+      template <class F> void parallel_for(size_t n, size_t chunk_size,
+                                           size_t worker_count, F f) const
+      {
+        std::atomic<size_t> cursor(0);
+        auto work = [n, chunk_size, &f, &cursor]()
+          {
+            for (;;)
+              {
+                size_t begin = cursor.fetch_add(chunk_size);
+                if (begin >= n)
+                  { break; }
+                size_t end = std::min(begin + chunk_size, n);
+                for (size_t i = begin; i < end; ++i)
+                  { f(i); }
+              }
+          };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < worker_count; ++i)
+          { workers.push_back(std::thread(work)); }
+        work();
+        for (size_t i = 0; i < workers.size(); ++i)
+          { workers[i].join(); }
+      }
+
+      size_t arc_index(HfstFrozenTransducer::const_iterator it) const
+      { return it - fsm.begin(0); }
+
+      void encode_labels()
+      {
+        std::unordered_map<Label, unsigned int, LabelHash> labels;
+        arc_labels.assign(fsm.arc_count(), 0);
+        std::vector<std::pair<unsigned int, unsigned int> > pairs;
+        for (HfstState s = 0; s < fsm.state_count(); ++s)
+          {
+            pairs.clear();
+            for (HfstFrozenTransducer::const_iterator it = fsm.begin(s);
+                 it != fsm.end(s); ++it)
+              {
+                pairs.push_back(std::make_pair(it->input, it->output));
+                Label l = { it->input, it->output, quantize(it->weight) };
+                std::unordered_map<Label, unsigned int, LabelHash>::
+                  const_iterator found = labels.find(l);
+                unsigned int id = labels.size();
+                if (found == labels.end())
+                  { labels[l] = id; }
+                else
+                  { id = found->second; }
+                arc_labels[arc_index(it)] = id;
+              }
+            std::sort(pairs.begin(), pairs.end());
+            if (std::adjacent_find(pairs.begin(), pairs.end()) != pairs.end())
+              {
+                HFST_THROW_MESSAGE(HfstFatalException,
+                                   "HfstMinimizer: transducer is not "
+                                   "deterministic");
+              }
+          }
+      }
+
+      void build_incoming()
+      {
+        HfstState state_count = fsm.state_count();
+        in_offsets.assign(state_count + 1, 0);
+        for (HfstState s = 0; s < state_count; ++s)
+          {
+            for (HfstFrozenTransducer::const_iterator it = fsm.begin(s);
+                 it != fsm.end(s); ++it)
+              { ++in_offsets[it->target + 1]; }
+          }
+        for (HfstState s = 0; s < state_count; ++s)
+          { in_offsets[s + 1] += in_offsets[s]; }
+        in_arcs.resize(fsm.arc_count());
+        std::vector<size_t> fill(in_offsets.begin(), in_offsets.end() - 1);
+        for (HfstState s = 0; s < state_count; ++s)
+          {
+            for (HfstFrozenTransducer::const_iterator it = fsm.begin(s);
+                 it != fsm.end(s); ++it)
+              {
+                InArc arc = { arc_labels[arc_index(it)], s };
+                in_arcs[fill[it->target]++] = arc;
+              }
+          }
+        size_t worker_count =
+          std::min<size_t>(thread_count,
+                           (state_count + CHUNK_SIZE - 1) / CHUNK_SIZE);
+        parallel_for(state_count, CHUNK_SIZE, worker_count, [this](size_t s)
+                     {
+                       std::sort(in_arcs.begin() + in_offsets[s],
+                                 in_arcs.begin() + in_offsets[s + 1]);
+                     });
+      }
+
+      void init_partition()
+      {
+        HfstState state_count = fsm.state_count();
+        elements.resize(state_count);
+        for (HfstState s = 0; s < state_count; ++s)
+          { elements[s] = s; }
+        // Non-final states first, then final states by final weight
+        std::stable_sort(elements.begin(), elements.end(),
+                         [this](HfstState s1, HfstState s2)
+                         {
+                           bool f1 = fsm.is_final_state(s1);
+                           bool f2 = fsm.is_final_state(s2);
+                           if (f1 != f2)
+                             { return f2; }
+                           return f1 &&
+                             quantize(fsm.get_final_weight(s1)) <
+                             quantize(fsm.get_final_weight(s2));
+                         });
+        location.resize(state_count);
+        block_of.resize(state_count);
+        block_begin.clear();
+        block_end.clear();
+        block_marked.clear();
+        agenda.clear();
+        for (size_t i = 0; i < state_count; ++i)
+          {
+            HfstState s = elements[i];
+            if (i == 0 ||
+                fsm.is_final_state(s) !=
+                fsm.is_final_state(elements[i - 1]) ||
+                (fsm.is_final_state(s) &&
+                 quantize(fsm.get_final_weight(s)) !=
+                 quantize(fsm.get_final_weight(elements[i - 1]))))
+              {
+                if (i != 0)
+                  { block_end.push_back(i); }
+                agenda.push_back(block_begin.size());
+                block_begin.push_back(i);
+                block_marked.push_back(i);
+              }
+            location[s] = i;
+            block_of[s] = block_begin.size() - 1;
+          }
+        if (state_count != 0)
+          { block_end.push_back(state_count); }
+      }
+
+      void mark(HfstState s)
+      {
+        unsigned int b = block_of[s];
+        size_t i = location[s];
+        size_t m = block_marked[b];
+        if (i < m)
+          { return; }
+        if (m == block_begin[b])
+          { touched.push_back(b); }
+        HfstState other = elements[m];
+        elements[m] = s;
+        location[s] = m;
+        elements[i] = other;
+        location[other] = i;
+        ++block_marked[b];
+      }
+
+      // Split the touched blocks into their marked and unmarked parts, the
+      // smaller of which becomes a new block and a splitter
+      void split_touched()
+      {
+        for (std::vector<unsigned int>::const_iterator it = touched.begin();
+             it != touched.end(); ++it)
+          {
+            unsigned int b = *it;
+            size_t begin = block_begin[b];
+            size_t middle = block_marked[b];
+            size_t end = block_end[b];
+            block_marked[b] = begin;
+            if (middle == end)
+              { continue; }
+            unsigned int new_block = block_begin.size();
+            if (middle - begin <= end - middle)
+              {
+                block_begin.push_back(begin);
+                block_end.push_back(middle);
+                block_begin[b] = middle;
+                block_marked[b] = middle;
+              }
+            else
+              {
+                block_begin.push_back(middle);
+                block_end.push_back(end);
+                block_end[b] = middle;
+              }
+            block_marked.push_back(block_begin.back());
+            for (size_t i = block_begin.back(); i < block_end.back(); ++i)
+              { block_of[elements[i]] = new_block; }
+            agenda.push_back(new_block);
+          }
+        touched.clear();
+      }
+
+      void refine()
+      {
+        std::vector<unsigned int> batch;
+        std::vector<std::vector<InArc> > predecessors;
+        size_t batch_size = 4 * thread_count;
+        refine_workers = 0;
+        while (!agenda.empty())
+          {
+            batch.clear();
+            size_t arc_count = 0;
+            while (!agenda.empty() && batch.size() < batch_size)
+              {
+                unsigned int b = agenda.back();
+                batch.push_back(b);
+                agenda.pop_back();
+                for (size_t j = block_begin[b]; j < block_end[b]; ++j)
+                  {
+                    HfstState s = elements[j];
+                    arc_count += in_offsets[s + 1] - in_offsets[s];
+                  }
+              }
+            predecessors.resize(batch.size());
+            // The threads are chosen by the number of predecessors to
+            // gather; the splitters are handed out one at a time, since a
+            // single large block can be most of the work
+            size_t worker_count =
+              std::min<size_t>(std::min<size_t>(thread_count, batch.size()),
+                               1 + arc_count / MIN_ARCS_PER_THREAD);
+            refine_workers = std::max(refine_workers, worker_count);
+            // Collect the predecessors of each splitter, by label
+            parallel_for(batch.size(), 1, worker_count,
+                         [this, &batch, &predecessors](size_t i)
+              {
+                std::vector<InArc> &p = predecessors[i];
+                p.clear();
+                unsigned int b = batch[i];
+                for (size_t j = block_begin[b]; j < block_end[b]; ++j)
+                  {
+                    HfstState s = elements[j];
+                    p.insert(p.end(), in_arcs.begin() + in_offsets[s],
+                             in_arcs.begin() + in_offsets[s + 1]);
+                  }
+                std::sort(p.begin(), p.end());
+                p.erase(std::unique(p.begin(), p.end()), p.end());
+              });
+            for (size_t i = 0; i < batch.size(); ++i)
+              {
+                const std::vector<InArc> &p = predecessors[i];
+                for (size_t j = 0; j < p.size(); ++j)
+                  {
+                    mark(p[j].source);
+                    if (j + 1 == p.size() || p[j + 1].label != p[j].label)
+                      { split_touched(); }
+                  }
+              }
+          }
+      }
+
+      HfstBasicTransducer quotient() const
+      {
+        HfstBasicTransducer retval;
+        retval.name = fsm.get_name();
+        HfstBasicTransducer::HfstAlphabet alphabet;
+        for (std::vector<unsigned int>::const_iterator it =
+               fsm.get_alphabet().begin();
+             it != fsm.get_alphabet().end(); ++it)
+          { alphabet.insert(HfstFrozenTransducer::symbol_name(*it)); }
+        retval.add_symbols_to_alphabet(alphabet);
+        if (fsm.state_count() == 0)
+          { return retval; }
+
+        const HfstState unnumbered = static_cast<HfstState>(-1);
+        std::vector<HfstState> number(block_begin.size(), unnumbered);
+        std::vector<unsigned int> queue(1, block_of[0]);
+        number[block_of[0]] = 0;
+        for (size_t i = 0; i < queue.size(); ++i)
+          {
+            HfstState representative = elements[block_begin[queue[i]]];
+            for (HfstFrozenTransducer::const_iterator it =
+                   fsm.begin(representative); it != fsm.end(representative);
+                 ++it)
+              {
+                unsigned int b = block_of[it->target];
+                if (number[b] == unnumbered)
+                  {
+                    number[b] = queue.size();
+                    queue.push_back(b);
+                  }
+              }
+          }
+        if (queue.size() > 1)
+          { retval.add_state(queue.size() - 1); }
+        for (size_t i = 0; i < queue.size(); ++i)
+          {
+            HfstState representative = elements[block_begin[queue[i]]];
+            HfstBasicTransitions &transitions = retval.transitions(i);
+            for (HfstFrozenTransducer::const_iterator it =
+                   fsm.begin(representative); it != fsm.end(representative);
+                 ++it)
+              {
+                transitions.push_back
+                  (HfstBasicTransition(number[block_of[it->target]],
+                                       it->input, it->output, it->weight,
+                                       false));
+              }
+            if (fsm.is_final_state(representative))
+              {
+                retval.set_final_weight
+                  (i, fsm.get_final_weight(representative));
+              }
+          }
+        return retval;
+      }
+    };
+
+  }
+}
+
+#endif // #ifndef _HFST_MINIMIZER_H_
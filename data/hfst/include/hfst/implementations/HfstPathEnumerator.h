@@ -0,0 +1,447 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+#ifndef _HFST_PATH_ENUMERATOR_H_
+#define _HFST_PATH_ENUMERATOR_H_
+
+/** @file HfstPathEnumerator.h
+    @brief Class HfstPathEnumerator */
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+#include "HfstFrozenTransducer.h"
+
+namespace hfst {
+  namespace implementations {
+
+    /** @brief Enumerate the paths of a transducer with several threads,
+        streaming them to a callback.
+
+        The search is split at the first arcs from the start state: the
+        prefixes of up to a few arcs are expanded depth-first until there
+        are enough of them to keep the threads busy, and each worker thread
+        then takes the next prefix and enumerates the paths that extend
+        it. Paths are passed in batches through buffers of bounded size to
+        the calling thread, which is the only one that calls the callback.
+
+        In deterministic order, the paths come in the order of a
+        sequential depth-first search: the buffer of each prefix is emptied
+        in turn, and a thread that is ahead of the output waits when its
+        buffer is full. Otherwise the paths come as they are found.
+
+        As with HfstTransducer::extract_paths, a state may occur on one
+        path at most \a cycles + 1 times, unlimited if \a cycles is
+        negative. Paths contain all their symbol pairs, epsilons included;
+        with \a filter_fd, paths whose flag diacritics on the input side
+        fail are skipped and the flag diacritics are left out. */
+    class HfstPathEnumerator
+    {
+    public:
+      /** @brief Called with each path in the calling thread. Returning
+          false stops the enumeration. */
+      typedef std::function<bool(const HfstTwoLevelPath &)> Callback;
+
+      /** @brief Prepare to enumerate the paths of \a t, which must outlive
+          the enumerator, with \a threads threads, or one per hardware
+          thread if zero. */
+      HfstPathEnumerator(const HfstFrozenTransducer &t,
+                         unsigned int threads = 0):
+        fsm(t), thread_count(threads), buffer_batches(64)
+      {
+        if (thread_count == 0)
+          {
+            thread_count =
+              std::max(1u, std::thread::hardware_concurrency());
+          }
+        for (std::vector<unsigned int>::const_iterator it =
+               fsm.get_alphabet().begin(); it != fsm.get_alphabet().end();
+             ++it)
+          {
+            const std::string &name = HfstFrozenTransducer::symbol_name(*it);
+            if (FdOperation::is_diacritic(name))
+              { flags.define_diacritic(*it, name); }
+          }
+      }
+
+      /** @brief Buffer at most \a batches batches of paths per buffer. */
+      void set_buffer_size(size_t batches)
+      { buffer_batches = std::max<size_t>(1, batches); }
+
+      /** @brief Call \a callback with at most \a max_num paths, unlimited
+          if not positive.
+
+          An exception thrown by \a callback stops the worker threads and
+          is passed on to the caller.
+
+          @throws TransducerIsCyclicException if the transducer is cyclic
+          and neither \a max_num nor \a cycles limits the search. */
+      void enumerate(const Callback &callback, int max_num = -1,
+                     int cycles = -1, bool filter_fd = false,
+                     bool deterministic = true)
+      {
+        if (fsm.state_count() == 0)
+          { return; }
+        if (max_num <= 0 && cycles < 0)
+          { fsm.longest_path_size(); }
+
+        Search search(callback, max_num, cycles, filter_fd, deterministic);
+        split(search);
+        if (search.tasks.empty())
+          { return; }
+        search.channels.resize(deterministic ? search.tasks.size() : 1);
+
+        std::vector<std::thread> workers;
+        size_t worker_count = std::min<size_t>(thread_count,
+                                               search.tasks.size());
+        for (size_t i = 0; i < worker_count; ++i)
+          {
+            workers.push_back(std::thread([this, &search]()
+                                          { work(search); }));
+          }
+        try
+          { consume(search); }
+        catch (...)
+          {
+            // The callback threw: stop the workers before unwinding, since
+            // they refer to search
+            {
+              std::lock_guard<std::mutex> lock(search.mutex);
+              search.stop = true;
+              search.space.notify_all();
+            }
+            for (size_t i = 0; i < workers.size(); ++i)
+              { workers[i].join(); }
+            throw;
+          }
+        for (size_t i = 0; i < workers.size(); ++i)
+          { workers[i].join(); }
+        if (search.error)
+          { std::rethrow_exception(search.error); }
+      }
+
+      /** @brief Insert at most \a max_num paths into \a results. When
+          \a max_num limits the search, the paths are taken in deterministic
+          order, so the same ones are found on every run. */
+      void enumerate(HfstTwoLevelPaths &results, int max_num = -1,
+                     int cycles = -1, bool filter_fd = false)
+      {
+        enumerate([&results](const HfstTwoLevelPath &path)
+                  {
+                    results.insert(path);
+                    return true;
+                  },
+                  max_num, cycles, filter_fd, max_num > 0);
+      }
+
+    protected:
+      typedef HfstFrozenTransducer::Arc Arc;
+      typedef std::vector<HfstTwoLevelPath> Batch;
+
+      static const size_t BATCH_SIZE = 64;
+      static const size_t MAX_SPLIT_DEPTH = 8;
+
+      // A prefix of paths: either a complete path to emit, or the start
+      // of a subtree to search
+      struct Task
+      {
+        bool emit_only;
+        HfstState state;
+        float weight;
+        std::vector<const Arc *> arcs;
+        std::vector<FdValue> flag_values;
+      };
+
+      struct Channel
+      {
+        std::deque<Batch> batches;
+        bool done;
+        Channel(): done(false) {}
+      };
+
+      struct Search
+      {
+        const Callback &callback;
+        int max_num;
+        int cycles;
+        bool filter_fd;
+        bool deterministic;
+        std::vector<Task> tasks;
+        std::atomic<size_t> next_task;
+        std::atomic<bool> stop;
+        std::mutex mutex;
+        std::condition_variable space;
+        std::condition_variable data;
+        std::vector<Channel> channels;
+        size_t finished_tasks;
+        std::exception_ptr error;
+        Search(const Callback &c, int m, int cy, bool f, bool d):
+          callback(c), max_num(m), cycles(cy), filter_fd(f),
+          deterministic(d), next_task(0), stop(false), finished_tasks(0)
+        {}
+      };
+
+      // The state of a depth-first search in one thread
+      struct Walker
+      {
+        Search &search;
+        std::vector<unsigned int> visits;
+        FdState<unsigned int> flag_state;
+        std::vector<const Arc *> path;
+        // Where tasks go when splitting, and paths when searching
+        std::vector<Task> * split_tasks;
+        size_t split_depth;
+        Channel * channel;
+        Batch batch;
+        Walker(Search &s, const HfstFrozenTransducer &fsm,
+               const FdTable<unsigned int> &flags):
+          search(s), visits(fsm.state_count(), 0), flag_state(flags),
+          split_tasks(NULL), split_depth(0), channel(NULL) {}
+      };
+
+      const HfstFrozenTransducer &fsm;
+      unsigned int thread_count;
+      size_t buffer_batches;
+      FdTable<unsigned int> flags;
+
+      HfstTwoLevelPath make_path(const Walker &w, float weight) const
+      {
+        HfstTwoLevelPath path;
+        path.first = weight;
+        path.second.reserve(w.path.size());
+        for (std::vector<const Arc *>::const_iterator it = w.path.begin();
+             it != w.path.end(); ++it)
+          {
+            if (w.search.filter_fd && flags.is_diacritic((*it)->input))
+              { continue; }
+            path.second.push_back
+              (StringPair(HfstFrozenTransducer::symbol_name((*it)->input),
+                          HfstFrozenTransducer::symbol_name((*it)->output)));
+          }
+        return path;
+      }
+
+      Task make_task(const Walker &w, HfstState s, float weight,
+                     bool emit_only) const
+      {
+        Task task;
+        task.emit_only = emit_only;
+        task.state = s;
+        task.weight = weight;
+        task.arcs = w.path;
+        task.flag_values = w.flag_state.get_values();
+        return task;
+      }
+
+      // Hand the current batch of w to the consumer, waiting for room
+      bool flush(Walker &w) const
+      {
+        std::unique_lock<std::mutex> lock(w.search.mutex);
+        w.search.space.wait(lock, [this, &w]()
+                            {
+                              return w.search.stop ||
+                                w.channel->batches.size() < buffer_batches;
+                            });
+        if (w.search.stop)
+          { return false; }
+        if (!w.batch.empty())
+          {
+            w.channel->batches.push_back(Batch());
+            w.channel->batches.back().swap(w.batch);
+            w.search.data.notify_all();
+          }
+        return true;
+      }
+
+      bool emit(Walker &w, float weight) const
+      {
+        w.batch.push_back(make_path(w, weight));
+        if (w.batch.size() >= BATCH_SIZE)
+          { return flush(w); }
+        return !w.search.stop;
+      }
+
+      // Search from state s at depth depth. Returns false if the search
+      // is to be stopped.
+      bool walk(Walker &w, HfstState s, float weight, size_t depth) const
+      {
+        if (w.split_tasks != NULL && depth == w.split_depth)
+          {
+            w.split_tasks->push_back(make_task(w, s, weight, false));
+            return true;
+          }
+        if (w.search.cycles >= 0 &&
+            w.visits[s] > static_cast<unsigned int>(w.search.cycles))
+          { return true; }
+        ++w.visits[s];
+        bool go_on = true;
+        if (fsm.is_final_state(s))
+          {
+            float total = weight + fsm.get_final_weight(s);
+            if (w.split_tasks != NULL)
+              { w.split_tasks->push_back(make_task(w, s, total, true)); }
+            else
+              { go_on = emit(w, total); }
+          }
+        for (HfstFrozenTransducer::const_iterator it = fsm.begin(s);
+             go_on && it != fsm.end(s); ++it)
+          {
+            bool is_flag = w.search.filter_fd && flags.is_diacritic(it->input);
+            std::vector<FdValue> saved;
+            if (is_flag)
+              {
+                saved = w.flag_state.get_values();
+                if (!w.flag_state.apply_operation(it->input))
+                  {
+                    w.flag_state.assign_values(saved);
+                    continue;
+                  }
+              }
+            w.path.push_back(&*it);
+            go_on = walk(w, it->target, weight + it->weight, depth + 1);
+            w.path.pop_back();
+            if (is_flag)
+              { w.flag_state.assign_values(saved); }
+          }
+        --w.visits[s];
+        return go_on;
+      }
+
+      // Expand prefixes until there are enough tasks for the threads
+      void split(Search &search) const
+      {
+        search.tasks.clear();
+        Walker w(search, fsm, flags);
+        std::vector<Task> tasks;
+        for (size_t depth = (thread_count > 1 ? 1 : 0);
+             depth <= MAX_SPLIT_DEPTH; ++depth)
+          {
+            tasks.clear();
+            w.split_tasks = &tasks;
+            w.split_depth = depth;
+            walk(w, 0, 0.0, 0);
+            search.tasks.swap(tasks);
+            size_t subtrees = 0;
+            for (size_t i = 0; i < search.tasks.size(); ++i)
+              {
+                if (!search.tasks[i].emit_only)
+                  { ++subtrees; }
+              }
+            if (subtrees == 0 || subtrees >= 8 * thread_count)
+              { break; }
+          }
+      }
+
+      void run(Walker &w, const Task &task) const
+      {
+        if (task.emit_only)
+          {
+            w.path = task.arcs;
+            emit(w, task.weight);
+            return;
+          }
+        // Restore the visits of the states on the prefix
+        std::vector<HfstState> prefix_states(1, 0);
+        for (size_t i = 0; i + 1 < task.arcs.size(); ++i)
+          { prefix_states.push_back(task.arcs[i]->target); }
+        if (task.arcs.empty())
+          { prefix_states.clear(); }
+        for (size_t i = 0; i < prefix_states.size(); ++i)
+          { ++w.visits[prefix_states[i]]; }
+        w.path = task.arcs;
+        w.flag_state.assign_values(task.flag_values);
+        walk(w, task.state, task.weight, 0);
+        for (size_t i = 0; i < prefix_states.size(); ++i)
+          { --w.visits[prefix_states[i]]; }
+      }
+
+      void work(Search &search) const
+      {
+        try
+          {
+            Walker w(search, fsm, flags);
+            size_t i;
+            while (!search.stop &&
+                   (i = search.next_task.fetch_add(1)) < search.tasks.size())
+              {
+                w.channel = &search.channels[search.deterministic ? i : 0];
+                run(w, search.tasks[i]);
+                flush(w);
+                w.batch.clear();
+                std::lock_guard<std::mutex> lock(search.mutex);
+                if (search.deterministic)
+                  { w.channel->done = true; }
+                ++search.finished_tasks;
+                search.data.notify_all();
+              }
+          }
+        catch (...)
+          {
+            std::lock_guard<std::mutex> lock(search.mutex);
+            if (!search.error)
+              { search.error = std::current_exception(); }
+            search.stop = true;
+            search.space.notify_all();
+            search.data.notify_all();
+          }
+      }
+
+      void consume(Search &search) const
+      {
+        size_t current = 0;
+        long emitted = 0;
+        std::unique_lock<std::mutex> lock(search.mutex);
+        while (!search.stop)
+          {
+            Channel &channel = search.channels[search.deterministic ?
+                                               current : 0];
+            if (!channel.batches.empty())
+              {
+                Batch batch;
+                batch.swap(channel.batches.front());
+                channel.batches.pop_front();
+                search.space.notify_all();
+                lock.unlock();
+                bool go_on = true;
+                for (Batch::const_iterator it = batch.begin();
+                     go_on && it != batch.end(); ++it)
+                  {
+                    go_on = search.callback(*it) &&
+                      (search.max_num <= 0 || ++emitted < search.max_num);
+                  }
+                lock.lock();
+                if (!go_on)
+                  { search.stop = true; }
+                continue;
+              }
+            if (search.deterministic && channel.done)
+              {
+                if (++current == search.tasks.size())
+                  { break; }
+                continue;
+              }
+            if (search.finished_tasks == search.tasks.size())
+              { break; }
+            search.data.wait(lock);
+          }
+        search.stop = true;
+        search.space.notify_all();
+      }
+    };
+
+  }
+}
+
+#endif // #ifndef _HFST_PATH_ENUMERATOR_H_
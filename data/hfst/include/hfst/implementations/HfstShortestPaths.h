@@ -0,0 +1,330 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+#ifndef _HFST_SHORTEST_PATHS_H_
+#define _HFST_SHORTEST_PATHS_H_
+
+/** @file HfstShortestPaths.h
+    @brief Class HfstShortestPaths */
+
+#include <vector>
+#include <deque>
+#include <queue>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <limits>
+#include <stdint.h>
+
+#include "HfstFrozenTransducer.h"
+
+namespace hfst {
+  namespace implementations {
+
+    /** @brief The n best paths of a transducer, found directly instead of
+        through HfstTransducer::n_best and extract_paths.
+
+        The distance from each state to a final state is computed once.
+        The search then extends paths best first, ordered by their weight
+        plus the distance left, so the paths come out lightest first. A
+        state is left at most n times, which bounds the search by n times
+        the number of transitions.
+
+        With flag diacritics obeyed, a state is told apart by the values of
+        the flags as well, and paths whose flags fail are not extended.
+
+        Weights may be negative, but a cycle of negative weight that can
+        reach a final state is an error. */
+    class HfstShortestPaths
+    {
+    public:
+      /** @brief Called with each path, lightest first. Returning false
+          stops the search. */
+      typedef std::function<bool(const HfstTwoLevelPath &)> Callback;
+
+      /** @brief Prepare to search \a t, which must outlive the object.
+
+          @throws HfstFatalException if a cycle of negative weight can
+          reach a final state. */
+      HfstShortestPaths(const HfstFrozenTransducer &t):
+        fsm(t), has_flags(false)
+      {
+        for (std::vector<unsigned int>::const_iterator it =
+               fsm.get_alphabet().begin(); it != fsm.get_alphabet().end();
+             ++it)
+          {
+            const std::string &name = HfstFrozenTransducer::symbol_name(*it);
+            if (FdOperation::is_diacritic(name))
+              {
+                flags.define_diacritic(*it, name);
+                has_flags = true;
+              }
+          }
+        compute_distances();
+      }
+
+      /** @brief Call \a callback with the \a n lightest paths, lightest
+          first, or until it returns false. Paths of equal weight come in
+          the order in which they were found.
+
+          If \a obey_flags, paths whose flag diacritics on the input side
+          fail are skipped. If \a filter_fd, flag diacritics are left out
+          of the paths. */
+      void n_best(unsigned int n, const Callback &callback,
+                  bool obey_flags = true, bool filter_fd = true) const
+      {
+        if (n == 0 || fsm.state_count() == 0 || distances[0] == infinite())
+          { return; }
+        Search search(n, obey_flags && has_flags, filter_fd, fsm, flags);
+        push(search, 0, 0, NULL, 0, 0.0);
+        unsigned int found = 0;
+        while (!search.agenda.empty() && found < n)
+          {
+            Entry entry = search.agenda.top();
+            search.agenda.pop();
+            const Node node = search.nodes[entry.node];
+            if (node.state == FINAL)
+              {
+                ++found;
+                if (!callback(make_path(search, entry.node, node.weight)))
+                  { return; }
+                continue;
+              }
+            unsigned int &pops = search.pop_count(node.state, node.config);
+            if (pops >= n)
+              { continue; }
+            ++pops;
+            if (fsm.is_final_state(node.state))
+              {
+                push(search, FINAL, 0, NULL, entry.node,
+                     node.weight + fsm.get_final_weight(node.state));
+              }
+            for (HfstFrozenTransducer::const_iterator it =
+                   fsm.begin(node.state); it != fsm.end(node.state); ++it)
+              {
+                if (distances[it->target] == infinite())
+                  { continue; }
+                unsigned int config = node.config;
+                if (search.obey_flags && flags.is_diacritic(it->input))
+                  {
+                    search.flag_state.assign_values
+                      (search.configs[node.config]);
+                    if (!search.flag_state.apply_operation(it->input))
+                      { continue; }
+                    config = search.config_of
+                      (search.flag_state.get_values());
+                  }
+                if (search.pop_count(it->target, config) >= n)
+                  { continue; }
+                push(search, it->target, config, &*it, entry.node,
+                     node.weight + it->weight);
+              }
+          }
+      }
+
+      /** @brief Insert the \a n lightest paths into \a results. */
+      void n_best(unsigned int n, HfstTwoLevelPaths &results,
+                  bool obey_flags = true, bool filter_fd = true) const
+      {
+        n_best(n, [&results](const HfstTwoLevelPath &path)
+               {
+                 results.insert(path);
+                 return true;
+               },
+               obey_flags, filter_fd);
+      }
+
+      /** @brief The weight of the lightest path from state \a s to a final
+          state, or infinity if there is none. */
+      float distance(HfstState s) const
+      { return distances.at(s); }
+
+    protected:
+      typedef HfstFrozenTransducer::Arc Arc;
+
+      static const HfstState FINAL = static_cast<HfstState>(-1);
+
+      static float infinite()
+      { return std::numeric_limits<float>::infinity(); }
+
+      // A path in the search tree: the arc that ends it and the path
+      // before that arc. A path to FINAL has been accepted.
+      struct Node
+      {
+        HfstState state;
+        unsigned int config;
+        const Arc * arc;
+        size_t parent;
+        float weight;
+      };
+
+      // A path on the agenda, by its weight plus the distance left
+      struct Entry
+      {
+        float priority;
+        size_t node;
+        bool operator<(const Entry &another) const
+        {
+          // Reversed for std::priority_queue; earlier nodes first on ties
+          if (priority != another.priority)
+            { return priority > another.priority; }
+          return node > another.node;
+        }
+      };
+
+      struct Search
+      {
+        unsigned int n;
+        bool obey_flags;
+        bool filter_fd;
+        std::vector<Node> nodes;
+        std::priority_queue<Entry> agenda;
+        // Pop counts by state without flags, by (state, config) with them
+        std::vector<unsigned int> pops;
+        std::unordered_map<uint64_t, unsigned int> flag_pops;
+        // The distinct flag values met, numbered
+        std::deque<std::vector<FdValue> > configs;
+        std::map<std::vector<FdValue>, unsigned int> config_numbers;
+        FdState<unsigned int> flag_state;
+        Search(unsigned int n_, bool o, bool f,
+               const HfstFrozenTransducer &fsm,
+               const FdTable<unsigned int> &flags):
+          n(n_), obey_flags(o), filter_fd(f), flag_state(flags)
+        {
+          if (!obey_flags)
+            { pops.resize(fsm.state_count(), 0); }
+          config_of(flag_state.get_values());
+        }
+        unsigned int &pop_count(HfstState s, unsigned int config)
+        {
+          if (!obey_flags)
+            { return pops[s]; }
+          return flag_pops[(static_cast<uint64_t>(config) << 32) | s];
+        }
+        unsigned int config_of(const std::vector<FdValue> &values)
+        {
+          std::map<std::vector<FdValue>, unsigned int>::const_iterator it =
+            config_numbers.find(values);
+          if (it != config_numbers.end())
+            { return it->second; }
+          configs.push_back(values);
+          config_numbers[values] = configs.size() - 1;
+          return configs.size() - 1;
+        }
+      };
+
+      const HfstFrozenTransducer &fsm;
+      FdTable<unsigned int> flags;
+      bool has_flags;
+      // The weight of the lightest path from each state to a final state
+      std::vector<float> distances;
+
+      // Bellman-Ford from the final states backwards, with a queue
+      void compute_distances()
+      {
+        size_t n = fsm.state_count();
+        distances.assign(n, infinite());
+        std::vector<size_t> offsets(n + 1, 0);
+        for (HfstState s = 0; s < n; ++s)
+          {
+            for (HfstFrozenTransducer::const_iterator it = fsm.begin(s);
+                 it != fsm.end(s); ++it)
+              { ++offsets[it->target + 1]; }
+          }
+        for (size_t i = 0; i < n; ++i)
+          { offsets[i + 1] += offsets[i]; }
+        std::vector<const Arc *> incoming(offsets[n]);
+        std::vector<HfstState> sources(offsets[n]);
+        std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+        for (HfstState s = 0; s < n; ++s)
+          {
+            for (HfstFrozenTransducer::const_iterator it = fsm.begin(s);
+                 it != fsm.end(s); ++it)
+              {
+                incoming[fill[it->target]] = &*it;
+                sources[fill[it->target]++] = s;
+              }
+          }
+        std::deque<HfstState> queue;
+        std::vector<bool> queued(n, false);
+        std::vector<size_t> rounds(n, 0);
+        for (HfstState s = 0; s < n; ++s)
+          {
+            if (fsm.is_final_state(s))
+              {
+                distances[s] = fsm.get_final_weight(s);
+                queue.push_back(s);
+                queued[s] = true;
+              }
+          }
+        while (!queue.empty())
+          {
+            HfstState t = queue.front();
+            queue.pop_front();
+            queued[t] = false;
+            for (size_t i = offsets[t]; i < offsets[t + 1]; ++i)
+              {
+                HfstState s = sources[i];
+                float d = distances[t] + incoming[i]->weight;
+                if (d >= distances[s])
+                  { continue; }
+                distances[s] = d;
+                if (!queued[s])
+                  {
+                    // A state is queued at most once per round, and
+                    // n rounds suffice without negative cycles
+                    if (++rounds[s] > n)
+                      {
+                        HFST_THROW_MESSAGE(HfstFatalException,
+                                           "HfstShortestPaths: cycle of "
+                                           "negative weight");
+                      }
+                    queue.push_back(s);
+                    queued[s] = true;
+                  }
+              }
+          }
+      }
+
+      void push(Search &search, HfstState s, unsigned int config,
+                const Arc * arc, size_t parent, float weight) const
+      {
+        Node node = { s, config, arc, parent, weight };
+        search.nodes.push_back(node);
+        Entry entry = { weight + (s == FINAL ? 0.0f : distances[s]),
+                        search.nodes.size() - 1 };
+        search.agenda.push(entry);
+      }
+
+      HfstTwoLevelPath make_path(const Search &search, size_t node,
+                                 float weight) const
+      {
+        HfstTwoLevelPath path;
+        path.first = weight;
+        std::vector<const Arc *> arcs;
+        for (size_t i = search.nodes[node].parent; search.nodes[i].arc != NULL;
+             i = search.nodes[i].parent)
+          { arcs.push_back(search.nodes[i].arc); }
+        for (std::vector<const Arc *>::const_reverse_iterator it =
+               arcs.rbegin(); it != arcs.rend(); ++it)
+          {
+            if (search.filter_fd && flags.is_diacritic((*it)->input))
+              { continue; }
+            path.second.push_back
+              (StringPair(HfstFrozenTransducer::symbol_name((*it)->input),
+                          HfstFrozenTransducer::symbol_name((*it)->output)));
+          }
+        return path;
+      }
+    };
+
+  }
+}
+
+#endif // #ifndef _HFST_SHORTEST_PATHS_H_
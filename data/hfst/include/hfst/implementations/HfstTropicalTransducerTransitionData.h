@@ -185,6 +185,11 @@ namespace hfst {
       friend class ComposeIntersectLexicon;
       friend class ComposeIntersectRule;
       friend class ComposeIntersectRulePair;
+      friend class ComposeIntersectParallel;
+      friend class HfstFrozenTransducer;
+      friend class HfstLookupIndex;
+      friend class HfstAttReader;
+      friend class HfstAttWriter;
       friend class HfstBasicTransducer;
 
     };
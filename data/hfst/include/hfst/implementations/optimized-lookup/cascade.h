@@ -0,0 +1,482 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+#ifndef _HFST_OL_TRANSDUCER_CASCADE_H_
+#define _HFST_OL_TRANSDUCER_CASCADE_H_
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+#include <memory>
+#include <unordered_map>
+#include <stdint.h>
+#include "transducer.h"
+
+namespace hfst_ol {
+
+/** \brief Lookup through a cascade of transducers without composing them
+    beforehand.
+
+    The output of each transducer is the input of the next. States of the
+    composition are tuples of the transducers' states, created only when
+    lookup reaches them. The arcs leaving a tuple with a given input symbol
+    are computed once and kept in a cache that holds at most
+    \a max_cached_expansions entries, dropping the least recently used one
+    when full.
+
+    Tuples are numbered as they are created and the numbers are kept until
+    the cache is cleared. So that a long-lived cascade does not grow without
+    bound, everything is cleared before a lookup once more than
+    \a max_composed_states tuples exist. A single lookup may still create
+    more than that many.
+
+    Symbols are renumbered into a table shared by the whole cascade, so the
+    transducers need not have the same alphabets. The table holds fewer
+    than NO_SYMBOL_NUMBER symbols; characters met in earlier lookups are
+    dropped before a lookup once they fill half of that, and
+    HfstFatalException is thrown if a single lookup still runs out. A symbol that a transducer
+    does not know takes its unknown and identity arcs; identity arcs output
+    the symbol read. Flag diacritics are obeyed separately in each
+    transducer, as when looking up in the result of a composition that
+    passes flags through, and do not appear in the output. An epsilon path
+    is cut when it comes back to the same state at the same input position
+    with the same flag values.
+*/
+class LazyCascade
+{
+protected:
+    typedef std::vector<TransitionTableIndex> StateTuple;
+
+    struct StateTupleHash
+    {
+        size_t operator()(const StateTuple & tuple) const
+            {
+                size_t h = 0;
+                for (size_t i = 0; i < tuple.size(); ++i) {
+                    h = h * 1000003 ^ tuple[i];
+                }
+                return h;
+            }
+    };
+
+    // An arc of the composition. The input symbol is the one it was
+    // expanded for; the output is in the cascade's symbol numbering.
+    struct CascadeArc
+    {
+        SymbolNumber output;
+        Weight weight;
+        unsigned int target;
+        // The transducer whose flag diacritic this arc carries, or
+        // NO_LEVEL; the flag is in that transducer's numbering
+        unsigned int flag_level;
+        SymbolNumber flag_symbol;
+    };
+
+    typedef std::vector<CascadeArc> CascadeArcVector;
+    typedef std::shared_ptr<const CascadeArcVector> CascadeArcsPtr;
+    typedef std::pair<uint64_t, CascadeArcsPtr> CacheEntry;
+    typedef std::list<CacheEntry> CacheList;
+
+    static const unsigned int NO_LEVEL = UINT_MAX;
+
+    // The cache key holds a tuple number and a symbol side by side
+    static_assert(sizeof(unsigned int) <= 4 && sizeof(SymbolNumber) <= 4,
+                  "cache key does not fit in 64 bits");
+
+    // A position in the input, a tuple and the flag values of every
+    // transducer, concatenated
+    typedef std::pair<std::pair<unsigned int, unsigned int>,
+                      std::vector<hfst::FdValue> > PathPoint;
+
+    std::vector<Transducer *> transducers;
+    // The cascade's symbol table and the mappings to and from each
+    // transducer's own numbering
+    std::vector<std::string> symbols;
+    std::map<std::string, SymbolNumber> symbol_numbers;
+    std::vector<SymbolNumberVector> to_local;
+    std::vector<SymbolNumberVector> to_global;
+
+    // The symbols known when the cascade was built; characters met in
+    // lookups are numbered after these
+    size_t base_symbol_count;
+
+    std::vector<StateTuple> tuples;
+    std::unordered_map<StateTuple, unsigned int, StateTupleHash> tuple_ids;
+    size_t max_composed_states;
+
+    size_t max_cached_expansions;
+    CacheList cache;
+    std::unordered_map<uint64_t, CacheList::iterator> cache_index;
+
+    struct Lookup
+    {
+        SymbolNumberVector input;
+        std::vector<hfst::FdState<SymbolNumber> > flags;
+        SymbolNumberVector output;
+        std::set<PathPoint> on_path;
+        hfst::HfstOneLevelPaths * results;
+        ssize_t limit;
+    };
+
+    SymbolNumber global_symbol(const std::string & symbol)
+    {
+        std::map<std::string, SymbolNumber>::iterator it =
+            symbol_numbers.find(symbol);
+        if (it != symbol_numbers.end()) {
+            return it->second;
+        }
+        if (symbols.size() >= NO_SYMBOL_NUMBER) {
+            HFST_THROW_MESSAGE(HfstFatalException,
+                               "too many symbols in transducer cascade");
+        }
+        SymbolNumber number = symbols.size();
+        symbols.push_back(symbol);
+        symbol_numbers[symbol] = number;
+        return number;
+    }
+
+    SymbolNumber local_symbol(size_t level, SymbolNumber global) const
+    {
+        const SymbolNumberVector & v = to_local[level];
+        return global < v.size() ? v[global] : NO_SYMBOL_NUMBER;
+    }
+
+    SymbolNumber global_of(size_t level, SymbolNumber local)
+    {
+        const SymbolNumberVector & v = to_global[level];
+        if (local < v.size()) {
+            return v[local];
+        }
+        // Added to the transducer's alphabet after this object was built
+        return global_symbol(
+            transducers[level]->get_alphabet().string_from_symbol(local));
+    }
+
+    unsigned int intern(const StateTuple & tuple)
+    {
+        std::unordered_map<StateTuple, unsigned int, StateTupleHash>::iterator
+            it = tuple_ids.find(tuple);
+        if (it != tuple_ids.end()) {
+            return it->second;
+        }
+        unsigned int id = tuples.size();
+        tuples.push_back(tuple);
+        tuple_ids[tuple] = id;
+        return id;
+    }
+
+    void add_arc(CascadeArcVector & arcs, SymbolNumber output, Weight weight,
+                 const StateTuple & to, unsigned int flag_level,
+                 SymbolNumber flag_symbol)
+    {
+        CascadeArc arc = {output, weight, intern(to), flag_level, flag_symbol};
+        arcs.push_back(arc);
+    }
+
+    // Pass the output @a out of transducer @a level on to the rest of the
+    // cascade
+    void pass_on(size_t level, SymbolNumber out, StateTuple & to, Weight w,
+                 CascadeArcVector & arcs)
+    {
+        if (out == 0) {
+            add_arc(arcs, 0, w, to, NO_LEVEL, 0);
+        } else {
+            expand(level + 1, out, to, w, arcs);
+        }
+    }
+
+    // The arcs of the transducers from @a level on, starting from the
+    // states in @a to, that read the cascade symbol @a x, or nothing if
+    // @a x is 0. @a to is restored before returning.
+    void expand(size_t level, SymbolNumber x, StateTuple & to, Weight w,
+                CascadeArcVector & arcs)
+    {
+        if (level == transducers.size()) {
+            if (x != 0) {
+                add_arc(arcs, x, w, to, NO_LEVEL, 0);
+            }
+            return;
+        }
+        Transducer * t = transducers[level];
+        const TransducerAlphabet & alphabet = t->get_alphabet();
+        TransitionTableIndex state = to[level];
+        if (x == 0) {
+            if (t->has_epsilons_or_flags(state + 1)) {
+                TransitionTableIndex next = t->next_e(state);
+                STransition i_s = t->take_epsilons_and_flags(next);
+                while (i_s.symbol != NO_SYMBOL_NUMBER) {
+                    SymbolNumber in =
+                        t->get_transition(next).get_input_symbol();
+                    to[level] = i_s.index;
+                    if (in != 0) {
+                        add_arc(arcs, 0, w + i_s.weight, to, level, in);
+                    } else {
+                        pass_on(level, global_of(level, i_s.symbol), to,
+                                w + i_s.weight, arcs);
+                    }
+                    to[level] = state;
+                    ++next;
+                    i_s = t->take_epsilons_and_flags(next);
+                }
+            }
+            // The later transducers move on their own
+            expand(level + 1, 0, to, w, arcs);
+            return;
+        }
+        SymbolNumber candidates[3] = {local_symbol(level, x),
+                                      NO_SYMBOL_NUMBER, NO_SYMBOL_NUMBER};
+        if (candidates[0] == NO_SYMBOL_NUMBER) {
+            candidates[1] = alphabet.get_unknown_symbol();
+            candidates[2] = alphabet.get_identity_symbol();
+        }
+        for (int c = 0; c < 3; ++c) {
+            SymbolNumber sym = candidates[c];
+            if (sym == NO_SYMBOL_NUMBER || !t->has_transitions(state + 1, sym)) {
+                continue;
+            }
+            TransitionTableIndex next = t->next(state, sym);
+            STransition i_s = t->take_non_epsilons(next, sym);
+            while (i_s.symbol != NO_SYMBOL_NUMBER) {
+                SymbolNumber out = i_s.symbol == alphabet.get_identity_symbol()
+                    ? x : global_of(level, i_s.symbol);
+                to[level] = i_s.index;
+                pass_on(level, out, to, w + i_s.weight, arcs);
+                to[level] = state;
+                ++next;
+                i_s = t->take_non_epsilons(next, sym);
+            }
+        }
+    }
+
+    CascadeArcsPtr get_arcs(unsigned int tuple, SymbolNumber x)
+    {
+        uint64_t key = (static_cast<uint64_t>(tuple) << 32) | x;
+        std::unordered_map<uint64_t, CacheList::iterator>::iterator it =
+            cache_index.find(key);
+        if (it != cache_index.end()) {
+            cache.splice(cache.begin(), cache, it->second);
+            return it->second->second;
+        }
+        CascadeArcVector * arcs = new CascadeArcVector;
+        CascadeArcsPtr retval(arcs);
+        StateTuple to = tuples[tuple];
+        expand(0, x, to, 0.0, *arcs);
+        if (max_cached_expansions != 0) {
+            if (cache.size() >= max_cached_expansions) {
+                cache_index.erase(cache.back().first);
+                cache.pop_back();
+            }
+            cache.push_front(CacheEntry(key, retval));
+            cache_index[key] = cache.begin();
+        }
+        return retval;
+    }
+
+    bool is_final(unsigned int tuple, Weight & weight) const
+    {
+        const StateTuple & states = tuples[tuple];
+        weight = 0.0;
+        for (size_t i = 0; i < transducers.size(); ++i) {
+            if (!transducers[i]->final_index(states[i])) {
+                return false;
+            }
+            weight += transducers[i]->final_weight(states[i]);
+        }
+        return true;
+    }
+
+    void take_arc(Lookup & lookup, const CascadeArc & arc, unsigned int pos,
+                  Weight w)
+    {
+        std::vector<hfst::FdValue> saved_flags;
+        if (arc.flag_level != NO_LEVEL) {
+            hfst::FdState<SymbolNumber> & flags = lookup.flags[arc.flag_level];
+            saved_flags = flags.get_values();
+            if (!flags.apply_operation(arc.flag_symbol)) {
+                flags.assign_values(saved_flags);
+                return;
+            }
+        }
+        if (arc.output != 0) {
+            lookup.output.push_back(arc.output);
+        }
+        search(lookup, pos, arc.target, w + arc.weight);
+        if (arc.output != 0) {
+            lookup.output.pop_back();
+        }
+        if (arc.flag_level != NO_LEVEL) {
+            lookup.flags[arc.flag_level].assign_values(saved_flags);
+        }
+    }
+
+    void search(Lookup & lookup, unsigned int pos, unsigned int tuple,
+                Weight w)
+    {
+        if (lookup.limit >= 0 &&
+            lookup.results->size() >= static_cast<size_t>(lookup.limit)) {
+            return;
+        }
+        // Epsilon loops may not come back to the same state at the same
+        // input position with the same flag values
+        PathPoint here(std::make_pair(pos, tuple),
+                       std::vector<hfst::FdValue>());
+        for (size_t i = 0; i < lookup.flags.size(); ++i) {
+            const std::vector<hfst::FdValue> & values =
+                lookup.flags[i].get_values();
+            here.second.insert(here.second.end(), values.begin(),
+                               values.end());
+        }
+        if (!lookup.on_path.insert(here).second) {
+            return;
+        }
+        Weight final_weight;
+        if (pos == lookup.input.size() && is_final(tuple, final_weight)) {
+            hfst::StringVector output;
+            for (size_t i = 0; i < lookup.output.size(); ++i) {
+                output.push_back(symbols[lookup.output[i]]);
+            }
+            lookup.results->insert(
+                hfst::HfstOneLevelPath(w + final_weight, output));
+        }
+        if (pos < lookup.input.size()) {
+            CascadeArcsPtr arcs = get_arcs(tuple, lookup.input[pos]);
+            for (size_t i = 0; i < arcs->size(); ++i) {
+                take_arc(lookup, (*arcs)[i], pos + 1, w);
+            }
+        }
+        CascadeArcsPtr arcs = get_arcs(tuple, 0);
+        for (size_t i = 0; i < arcs->size(); ++i) {
+            take_arc(lookup, (*arcs)[i], pos, w);
+        }
+        lookup.on_path.erase(here);
+    }
+
+    // Tokenize @a s with the first transducer's encoder. Characters it does
+    // not know get symbols of their own, for unknown and identity arcs.
+    bool tokenize(const std::string & s, SymbolNumberVector & input)
+    {
+        Encoder & encoder = const_cast<Encoder &>(
+            transducers[0]->get_encoder());
+        std::vector<char> buf(s.begin(), s.end());
+        buf.push_back('\0');
+        char * p = &buf[0];
+        while (*p != '\0') {
+            char * start = p;
+            SymbolNumber k = encoder.find_key(&p);
+            if (k != NO_SYMBOL_NUMBER && k < to_global[0].size()) {
+                input.push_back(to_global[0][k]);
+                continue;
+            }
+            p = start;
+            int bytes = nByte_utf8(static_cast<unsigned char>(*p));
+            if (bytes <= 0) {
+                return false;
+            }
+            std::string character;
+            for (int i = 0; i < bytes && *p != '\0'; ++i) {
+                character.push_back(*p++);
+            }
+            input.push_back(global_symbol(character));
+        }
+        return true;
+    }
+
+public:
+    /** Look up through @a cascade, first transducer first. The transducers
+        must outlive this object. At most @a max_cached expansions are
+        cached, and all composed states are dropped before a lookup once
+        there are more than @a max_states of them; 0 means no limit. */
+    LazyCascade(const std::vector<Transducer *> & cascade,
+                size_t max_cached = 100000, size_t max_states = 1000000):
+        transducers(cascade), base_symbol_count(0),
+        max_composed_states(max_states), max_cached_expansions(max_cached)
+        {
+            if (transducers.empty()) {
+                HFST_THROW_MESSAGE(HfstFatalException,
+                                   "empty transducer cascade");
+            }
+            global_symbol("");
+            for (size_t i = 0; i < transducers.size(); ++i) {
+                const TransducerAlphabet & alphabet =
+                    transducers[i]->get_alphabet();
+                const SymbolTable & table = alphabet.get_symbol_table();
+                SymbolNumber known = alphabet.get_orig_symbol_count();
+                if (known == 0 || known > table.size()) {
+                    known = table.size();
+                }
+                to_global.push_back(SymbolNumberVector(table.size(), 0));
+                to_local.push_back(SymbolNumberVector());
+                for (SymbolNumber s = 1; s < table.size(); ++s) {
+                    SymbolNumber global = global_symbol(table[s]);
+                    to_global[i][s] = global;
+                    if (s >= known || s == alphabet.get_unknown_symbol() ||
+                        s == alphabet.get_identity_symbol()) {
+                        continue;
+                    }
+                    if (to_local[i].size() <= global) {
+                        to_local[i].resize(global + 1, NO_SYMBOL_NUMBER);
+                    }
+                    to_local[i][global] = s;
+                }
+            }
+            base_symbol_count = symbols.size();
+            intern(StateTuple(transducers.size(), 0));
+        }
+
+    /** Tokenize and look up @a s through the cascade. Returns a newly
+        allocated set of at most @a limit (if non-negative) results, like
+        Transducer::lookup_fd(). */
+    hfst::HfstOneLevelPaths * lookup_fd(const std::string & s,
+                                        ssize_t limit = -1)
+    {
+        if ((max_composed_states != 0 &&
+             tuples.size() > max_composed_states) ||
+            symbols.size() - base_symbol_count > NO_SYMBOL_NUMBER / 2) {
+            clear_cache();
+        }
+        std::unique_ptr<hfst::HfstOneLevelPaths> results(
+            new hfst::HfstOneLevelPaths);
+        Lookup lookup;
+        lookup.results = results.get();
+        lookup.limit = limit;
+        if (!tokenize(s, lookup.input)) {
+            return results.release();
+        }
+        for (size_t i = 0; i < transducers.size(); ++i) {
+            lookup.flags.push_back(
+                hfst::FdState<SymbolNumber>(transducers[i]->get_fd_table()));
+        }
+        search(lookup, 0, 0, 0.0);
+        return results.release();
+    }
+
+    /** Drop all cached expansions and composed states, and the symbols of
+        characters met in earlier lookups. Not to be called during a
+        lookup. */
+    void clear_cache(void)
+    {
+        cache.clear();
+        cache_index.clear();
+        tuples.resize(1);
+        tuple_ids.clear();
+        tuple_ids[tuples[0]] = 0;
+        for (size_t i = base_symbol_count; i < symbols.size(); ++i) {
+            symbol_numbers.erase(symbols[i]);
+        }
+        symbols.resize(base_symbol_count);
+    }
+
+    size_t cached_expansions(void) const { return cache.size(); }
+    size_t composed_state_count(void) const { return tuples.size(); }
+};
+
+}
+
+#endif //_HFST_OL_TRANSDUCER_CASCADE_H_
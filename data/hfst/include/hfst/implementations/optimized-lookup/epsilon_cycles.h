@@ -0,0 +1,384 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+#ifndef _HFST_OL_TRANSDUCER_EPSILON_CYCLES_H_
+#define _HFST_OL_TRANSDUCER_EPSILON_CYCLES_H_
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <stdint.h>
+#include "transducer.h"
+
+namespace hfst_ol {
+
+/** \brief The states of a transducer that are on cycles of input epsilon
+    transitions, computed once and kept in a bitmap.
+
+    Transitions with epsilon or a flag diacritic on the input side count as
+    input epsilons, as they do in lookup; flag values are not obeyed. The
+    cycles are found as the strongly connected components of the input
+    epsilon transitions between the states reachable from the start state.
+
+    The bitmap has one bit per entry of the transition index and transition
+    tables, so checking a state costs one memory access. It can be written
+    after the transducer, or to a file of its own, and read back when the
+    transducer is loaded instead of being computed again.
+
+    With the bitmap, is_lookup_infinitely_ambiguous() follows the sets of
+    states reachable at each input position instead of searching the
+    paths, and lookup code can use on_epsilon_cycle() to cut off branches
+    that would loop.
+*/
+class EpsilonCycleIndex
+{
+public:
+    /** \brief Find the input epsilon cycles of \a t, which must outlive
+        the index. */
+    EpsilonCycleIndex(Transducer & t):
+        transducer(t),
+        index_table_size(t.get_header().index_table_size()),
+        target_table_size(t.get_header().target_table_size())
+        {
+            bits.assign(words_needed(), 0);
+            find_cycles();
+        }
+
+    /** \brief Read an index of \a t written by write() from \a is.
+
+        @throws TransducerHasWrongTypeException if \a is does not contain
+        an index of a transducer with the table sizes of \a t. */
+    EpsilonCycleIndex(Transducer & t, std::istream & is):
+        transducer(t),
+        index_table_size(t.get_header().index_table_size()),
+        target_table_size(t.get_header().target_table_size())
+        {
+            char magic[MAGIC_SIZE];
+            uint32_t sizes[4];
+            is.read(magic, sizeof(magic));
+            is.read(reinterpret_cast<char*>(sizes), sizeof(sizes));
+            if (!is || std::memcmp(magic, get_magic(), MAGIC_SIZE) != 0 ||
+                sizes[0] != VERSION || sizes[1] != index_table_size ||
+                sizes[2] != target_table_size ||
+                sizes[3] != words_needed()) {
+                HFST_THROW(TransducerHasWrongTypeException);
+            }
+            bits.resize(sizes[3]);
+            if (!bits.empty()) {
+                is.read(reinterpret_cast<char*>(&bits[0]),
+                        bits.size() * sizeof(uint64_t));
+            }
+            if (!is) {
+                HFST_THROW(TransducerHasWrongTypeException);
+            }
+        }
+
+    /** \brief Write the index to \a os. */
+    void write(std::ostream & os) const
+        {
+            uint32_t sizes[4] = { VERSION, index_table_size, target_table_size,
+                                  static_cast<uint32_t>(bits.size()) };
+            os.write(get_magic(), MAGIC_SIZE);
+            os.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+            if (!bits.empty()) {
+                os.write(reinterpret_cast<const char*>(&bits[0]),
+                         bits.size() * sizeof(uint64_t));
+            }
+        }
+
+    /** \brief Whether state \a i is on a cycle of input epsilons. */
+    bool on_epsilon_cycle(TransitionTableIndex i) const
+        {
+            size_t bit = bit_of(i);
+            return bit != NO_BIT && (bits[bit / 64] >> (bit % 64) & 1) != 0;
+        }
+
+    /** \brief Whether some state reachable from the start state is on a
+        cycle of input epsilons. */
+    bool is_infinitely_ambiguous(void) const
+        {
+            for (size_t i = 0; i < bits.size(); ++i) {
+                if (bits[i] != 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    /** \brief Whether looking up \a input can reach a cycle of input
+        epsilons, so that it may have infinitely many results. */
+    bool is_lookup_infinitely_ambiguous(const std::string & input)
+        {
+            if (!is_infinitely_ambiguous()) {
+                return false;
+            }
+            Encoder & encoder = const_cast<Encoder &>(
+                transducer.get_encoder());
+            std::vector<char> buf(input.begin(), input.end());
+            buf.push_back('\0');
+            char * p = &buf[0];
+            SymbolNumberVector symbols;
+            while (*p != '\0') {
+                char * start = p;
+                SymbolNumber k = encoder.find_key(&p);
+                if (k == NO_SYMBOL_NUMBER) {
+                    // Not in the alphabet: skip one character
+                    p = start;
+                    int bytes = nByte_utf8(static_cast<unsigned char>(*p));
+                    if (bytes <= 0) {
+                        return false;
+                    }
+                    for (int i = 0; i < bytes && *p != '\0'; ++i) {
+                        ++p;
+                    }
+                }
+                symbols.push_back(k);
+            }
+            return is_lookup_infinitely_ambiguous(symbols);
+        }
+
+    /** \brief Whether looking up the symbol strings \a input can reach a
+        cycle of input epsilons. */
+    bool is_lookup_infinitely_ambiguous(const StringVector & input)
+        {
+            if (!is_infinitely_ambiguous()) {
+                return false;
+            }
+            const TransducerAlphabet & alphabet = transducer.get_alphabet();
+            SymbolNumberVector symbols;
+            for (StringVector::const_iterator it = input.begin();
+                 it != input.end(); ++it) {
+                symbols.push_back(alphabet.symbol_from_string(*it));
+            }
+            return is_lookup_infinitely_ambiguous(symbols);
+        }
+
+protected:
+    static const uint32_t VERSION = 1;
+    static const size_t NO_BIT = static_cast<size_t>(-1);
+    static const size_t MAGIC_SIZE = 8;
+
+    static const char * get_magic(void)
+        { return "HFOLEPSC"; }
+
+    Transducer & transducer;
+    uint32_t index_table_size;
+    uint32_t target_table_size;
+    std::vector<uint64_t> bits;
+
+    size_t words_needed(void) const
+        {
+            return (static_cast<size_t>(index_table_size) +
+                    target_table_size + 63) / 64;
+        }
+
+    size_t bit_of(TransitionTableIndex i) const
+        {
+            if (indexes_transition_index_table(i)) {
+                return i < index_table_size ? i : NO_BIT;
+            }
+            i -= TRANSITION_TARGET_TABLE_START;
+            return i < target_table_size ? index_table_size + i : NO_BIT;
+        }
+
+    void set_bit(TransitionTableIndex i)
+        {
+            size_t bit = bit_of(i);
+            if (bit != NO_BIT) {
+                bits[bit / 64] |= static_cast<uint64_t>(1) << (bit % 64);
+            }
+        }
+
+    bool is_input_epsilon(SymbolNumber symbol)
+        {
+            return symbol == 0 || transducer.is_flag(symbol);
+        }
+
+    // Tarjan's algorithm over the input epsilon transitions, without
+    // recursion; the states are numbered as they are reached from the
+    // start state through any transitions
+    void find_cycles(void)
+        {
+            std::vector<TransitionTableIndex> states(1, 0);
+            std::vector<std::vector<unsigned int> > epsilon_targets;
+            std::vector<bool> self_loop;
+            std::vector<unsigned int> numbers(index_table_size +
+                                              target_table_size, UINT_MAX);
+            numbers[bit_of(0)] = 0;
+            for (size_t n = 0; n < states.size(); ++n) {
+                epsilon_targets.push_back(std::vector<unsigned int>());
+                self_loop.push_back(false);
+                TransitionTableIndexSet arcs =
+                    transducer.get_transitions_from_state(states[n]);
+                for (TransitionTableIndexSet::const_iterator it = arcs.begin();
+                     it != arcs.end(); ++it) {
+                    const Transition & arc = transducer.get_transition(*it);
+                    if (arc.get_input_symbol() == NO_SYMBOL_NUMBER) {
+                        continue;
+                    }
+                    size_t bit = bit_of(arc.get_target());
+                    if (bit == NO_BIT) {
+                        continue;
+                    }
+                    if (numbers[bit] == UINT_MAX) {
+                        numbers[bit] = states.size();
+                        states.push_back(arc.get_target());
+                    }
+                    if (is_input_epsilon(arc.get_input_symbol())) {
+                        if (numbers[bit] == n) {
+                            self_loop[n] = true;
+                        }
+                        epsilon_targets[n].push_back(numbers[bit]);
+                    }
+                }
+            }
+
+            size_t count = states.size();
+            std::vector<unsigned int> order(count, UINT_MAX);
+            std::vector<unsigned int> low(count, 0);
+            std::vector<bool> on_stack(count, false);
+            std::vector<unsigned int> stack;
+            // (state, next target to visit) pairs of the depth-first search
+            std::vector<std::pair<unsigned int, size_t> > calls;
+            unsigned int next_order = 0;
+            for (unsigned int root = 0; root < count; ++root) {
+                if (order[root] != UINT_MAX) {
+                    continue;
+                }
+                calls.push_back(std::make_pair(root, 0));
+                order[root] = low[root] = next_order++;
+                stack.push_back(root);
+                on_stack[root] = true;
+                while (!calls.empty()) {
+                    unsigned int s = calls.back().first;
+                    size_t & next = calls.back().second;
+                    if (next < epsilon_targets[s].size()) {
+                        unsigned int t = epsilon_targets[s][next++];
+                        if (order[t] == UINT_MAX) {
+                            order[t] = low[t] = next_order++;
+                            stack.push_back(t);
+                            on_stack[t] = true;
+                            calls.push_back(std::make_pair(t, 0));
+                        } else if (on_stack[t]) {
+                            low[s] = std::min(low[s], order[t]);
+                        }
+                        continue;
+                    }
+                    calls.pop_back();
+                    if (!calls.empty()) {
+                        unsigned int parent = calls.back().first;
+                        low[parent] = std::min(low[parent], low[s]);
+                    }
+                    if (low[s] != order[s]) {
+                        continue;
+                    }
+                    // s is the root of a component; it is a cycle if it
+                    // has several states or a loop
+                    bool cyclic = stack.back() != s || self_loop[s];
+                    unsigned int t;
+                    do {
+                        t = stack.back();
+                        stack.pop_back();
+                        on_stack[t] = false;
+                        if (cyclic) {
+                            set_bit(states[t]);
+                        }
+                    } while (t != s);
+                }
+            }
+        }
+
+    // Add to @a states the states reachable from them through input
+    // epsilons. Returns true if one of them is on an epsilon cycle.
+    bool close(std::vector<TransitionTableIndex> & states,
+               std::vector<bool> & seen)
+        {
+            for (size_t n = 0; n < states.size(); ++n) {
+                TransitionTableIndex state = states[n];
+                if (on_epsilon_cycle(state)) {
+                    return true;
+                }
+                if (!transducer.has_epsilons_or_flags(state + 1)) {
+                    continue;
+                }
+                TransitionTableIndex next = transducer.next_e(state);
+                STransition i_s = transducer.take_epsilons_and_flags(next);
+                while (i_s.symbol != NO_SYMBOL_NUMBER) {
+                    add(states, seen, i_s.index);
+                    ++next;
+                    i_s = transducer.take_epsilons_and_flags(next);
+                }
+            }
+            return false;
+        }
+
+    void add(std::vector<TransitionTableIndex> & states,
+             std::vector<bool> & seen, TransitionTableIndex state)
+        {
+            size_t bit = bit_of(state);
+            if (bit != NO_BIT && !seen[bit]) {
+                seen[bit] = true;
+                states.push_back(state);
+            }
+        }
+
+    bool is_lookup_infinitely_ambiguous(const SymbolNumberVector & input)
+        {
+            const TransducerAlphabet & alphabet = transducer.get_alphabet();
+            size_t table_size = static_cast<size_t>(index_table_size) +
+                target_table_size;
+            std::vector<bool> seen(table_size, false);
+            std::vector<TransitionTableIndex> states(1, 0);
+            seen[bit_of(0)] = true;
+            for (size_t pos = 0; ; ++pos) {
+                if (close(states, seen)) {
+                    return true;
+                }
+                if (pos == input.size()) {
+                    return false;
+                }
+                std::vector<TransitionTableIndex> next_states;
+                std::vector<bool> next_seen(table_size, false);
+                SymbolNumber candidates[3] = { input[pos], NO_SYMBOL_NUMBER,
+                                               NO_SYMBOL_NUMBER };
+                if (candidates[0] == NO_SYMBOL_NUMBER) {
+                    candidates[1] = alphabet.get_unknown_symbol();
+                    candidates[2] = alphabet.get_identity_symbol();
+                }
+                for (size_t n = 0; n < states.size(); ++n) {
+                    TransitionTableIndex state = states[n];
+                    for (int c = 0; c < 3; ++c) {
+                        SymbolNumber sym = candidates[c];
+                        if (sym == NO_SYMBOL_NUMBER ||
+                            !transducer.has_transitions(state + 1, sym)) {
+                            continue;
+                        }
+                        TransitionTableIndex next = transducer.next(state, sym);
+                        STransition i_s = transducer.take_non_epsilons(next,
+                                                                       sym);
+                        while (i_s.symbol != NO_SYMBOL_NUMBER) {
+                            add(next_states, next_seen, i_s.index);
+                            ++next;
+                            i_s = transducer.take_non_epsilons(next, sym);
+                        }
+                    }
+                }
+                if (next_states.empty()) {
+                    return false;
+                }
+                states.swap(next_states);
+                seen.swap(next_seen);
+            }
+        }
+};
+
+}
+
+#endif // _HFST_OL_TRANSDUCER_EPSILON_CYCLES_H_
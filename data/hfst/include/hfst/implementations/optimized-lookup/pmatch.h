@@ -136,6 +136,8 @@ namespace hfst_ol {
 
         friend class PmatchTransducer;
         friend class PmatchContainer;
+        friend class PmatchProfiler;
+        friend class PmatchBacktrackingRunner;
     };
 
     struct RtnStackFrame
@@ -273,6 +275,8 @@ namespace hfst_ol {
             { max_recursion = max; }
         void set_max_context(size_t max)
             { max_context_length = max; }
+        size_t get_max_context(void) const { return max_context_length; }
+        const PmatchAlphabet & get_alphabet(void) const { return alphabet; }
         bool is_in_locate_mode(void) { return locate_mode; }
         void set_profile(bool b) { profile_mode = b; }
         void set_weight(Weight w) { running_weight = w; }
@@ -313,6 +317,8 @@ namespace hfst_ol {
 
         friend class PmatchTransducer;
         friend class PmatchAlphabet;
+        friend class PmatchBacktrackingRunner;
+        friend class PmatchLiteralPrefilter;
     };
 
     struct Location
@@ -470,6 +476,7 @@ namespace hfst_ol {
         void handle_final_state(unsigned int input_pos, unsigned int tape_pos);
 
         friend class PmatchContainer;
+        friend class PmatchBacktrackingRunner;
     };
 
 }
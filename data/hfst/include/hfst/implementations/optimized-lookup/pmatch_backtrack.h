@@ -0,0 +1,360 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+#ifndef _HFST_OL_TRANSDUCER_PMATCH_BACKTRACK_H_
+#define _HFST_OL_TRANSDUCER_PMATCH_BACKTRACK_H_
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include "pmatch.h"
+#include "pmatch_profile.h"
+
+namespace hfst_ol {
+
+// A longest-match runner for pmatch grammars that don't need the full
+// PmatchTransducer machinery. When the toplevel transducer has no RTN calls,
+// captures, contexts, flag diacritics, symbol lists, counters, guards,
+// global flags, boundaries or unknown/identity symbols, and no input-epsilon
+// cycles, matching needs to track only the position, the weight and the
+// output tape. The container still encodes the input and stringifies the
+// result, so the output is the same as from match().
+//
+// The search is recursive backtracking over the transducer tables as they
+// are, not a determinized automaton: at each start position every path is
+// tried and the longest match, lightest on ties, is kept. It saves the
+// bookkeeping of PmatchTransducer, not the search itself, so a grammar
+// with much nondeterminism can still take time exponential in the length
+// of a match.
+//
+// Given a PmatchProfiler, the runner counts each search it does itself:
+// the pattern that matched, the arcs followed off the kept match as
+// backtracks, and the time of the search. Calls left to the container are
+// not counted.
+    class PmatchBacktrackingRunner
+    {
+    protected:
+        PmatchContainer & container;
+        PmatchTransducer * toplevel;
+        bool applicable;
+        PmatchProfiler * profiler;
+
+        // Per-call search state
+        const SymbolNumberVector * input;
+        DoubleTape path;
+        DoubleTape best_path;
+        unsigned int start_pos;
+        unsigned int best_pos;
+        Weight best_weight;
+        Weight weight_limit;
+        unsigned long long arcs_followed;
+
+        bool symbol_is_plain(SymbolNumber sym) const
+        {
+            const PmatchAlphabet & alphabet = container.alphabet;
+            if (sym == 0) {
+                return true;
+            }
+            if (sym == alphabet.get_unknown_symbol() ||
+                sym == alphabet.get_identity_symbol() ||
+                sym == alphabet.get_default_symbol() ||
+                alphabet.is_flag_diacritic(sym) ||
+                alphabet.is_capture_tag(sym) ||
+                alphabet.is_captured_tag(sym) ||
+                alphabet.is_input_mark(sym) ||
+                alphabet.is_guard(sym) ||
+                alphabet.is_counter(sym) ||
+                alphabet.is_global_flag(sym) ||
+                alphabet.has_rtn(sym)) {
+                return false;
+            }
+            if (sym < alphabet.symbol2lists.size() &&
+                alphabet.symbol2lists[sym] != NO_SYMBOL_NUMBER) {
+                return false;
+            }
+            if (sym < alphabet.list2symbols.size() &&
+                alphabet.list2symbols[sym] != NO_SYMBOL_NUMBER) {
+                return false;
+            }
+            for (size_t i = 0; i < alphabet.special_symbols.size(); ++i) {
+                if (alphabet.special_symbols[i] == sym) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Markers that stringify() knows how to print and that need no
+        // bookkeeping during matching
+        bool symbol_is_marker(SymbolNumber sym) const
+        {
+            const PmatchAlphabet & alphabet = container.alphabet;
+            return sym == alphabet.get_special(entry) ||
+                sym == alphabet.get_special(exit) ||
+                alphabet.is_end_tag(sym);
+        }
+
+        // The first transition table entry of the arcs leaving @a state with
+        // input @a sym, or NO_TABLE_INDEX. When @a whole_state is set the
+        // arcs of all symbols follow, up to the next state.
+        TransitionTableIndex first_arc(TransitionTableIndex state,
+                                       SymbolNumber sym,
+                                       bool & whole_state) const
+        {
+            if (PmatchTransducer::indexes_transition_table(state)) {
+                whole_state = true;
+                return state - TRANSITION_TARGET_TABLE_START + 1;
+            }
+            whole_state = false;
+            const std::vector<TransitionWIndex> & index = toplevel->index_table;
+            TransitionTableIndex i = state + 1 + sym;
+            if (i < index.size() && index[i].get_input_symbol() == sym) {
+                return index[i].get_target() - TRANSITION_TARGET_TABLE_START;
+            }
+            return NO_TABLE_INDEX;
+        }
+
+        size_t state_key(TransitionTableIndex state) const
+        {
+            if (PmatchTransducer::indexes_transition_table(state)) {
+                return toplevel->index_table.size() +
+                    (state - TRANSITION_TARGET_TABLE_START);
+            }
+            return state;
+        }
+
+        bool has_epsilon_cycle(TransitionTableIndex state,
+                               std::vector<char> & colour) const
+        {
+            // 0 = unvisited, 1 = on the current path, 2 = done
+            size_t key = state_key(state);
+            if (colour[key] == 1) {
+                return true;
+            }
+            if (colour[key] == 2) {
+                return false;
+            }
+            colour[key] = 1;
+            const std::vector<TransitionW> & table = toplevel->transition_table;
+            bool whole_state;
+            TransitionTableIndex j = first_arc(state, 0, whole_state);
+            for (; j < table.size(); ++j) {
+                SymbolNumber in = table[j].get_input_symbol();
+                if (in == NO_SYMBOL_NUMBER || (!whole_state && in != 0)) {
+                    break;
+                }
+                if (in == 0 && has_epsilon_cycle(table[j].get_target(), colour)) {
+                    return true;
+                }
+            }
+            colour[key] = 2;
+            return false;
+        }
+
+        bool detect(void)
+        {
+            if (toplevel == NULL) {
+                return false;
+            }
+            const std::vector<TransitionW> & table = toplevel->transition_table;
+            for (size_t j = 0; j < table.size(); ++j) {
+                SymbolNumber in = table[j].get_input_symbol();
+                SymbolNumber out = table[j].get_output_symbol();
+                if (in == NO_SYMBOL_NUMBER) {
+                    continue;
+                }
+                if (!symbol_is_plain(in)) {
+                    return false;
+                }
+                if (!symbol_is_plain(out) &&
+                    !(in == 0 && symbol_is_marker(out))) {
+                    return false;
+                }
+            }
+            // Index table entries only point into the transition table, so
+            // checking the latter covers every arc, and every state other than
+            // the start state is the target of some arc
+            std::vector<char> colour(toplevel->index_table.size() + table.size(),
+                                     0);
+            if (has_epsilon_cycle(0, colour)) {
+                return false;
+            }
+            for (size_t j = 0; j < table.size(); ++j) {
+                if (table[j].get_input_symbol() != NO_SYMBOL_NUMBER &&
+                    has_epsilon_cycle(table[j].get_target(), colour)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void note_final(unsigned int pos, Weight w)
+        {
+            if (pos > best_pos || (pos == best_pos && w < best_weight)) {
+                best_pos = pos;
+                best_weight = w;
+                best_path = path;
+            }
+        }
+
+        void take_arcs(TransitionTableIndex state, SymbolNumber sym,
+                       unsigned int pos, Weight w)
+        {
+            const std::vector<TransitionW> & table = toplevel->transition_table;
+            bool whole_state;
+            TransitionTableIndex j = first_arc(state, sym, whole_state);
+            for (; j < table.size(); ++j) {
+                SymbolNumber in = table[j].get_input_symbol();
+                if (in == NO_SYMBOL_NUMBER || (!whole_state && in != sym)) {
+                    break;
+                }
+                if (in != sym) {
+                    continue;
+                }
+                Weight nw = w + table[j].get_weight();
+                if (nw > weight_limit) {
+                    continue;
+                }
+                path.push_back(SymbolPair(in, table[j].get_output_symbol()));
+                ++arcs_followed;
+                walk(table[j].get_target(), in == 0 ? pos : pos + 1, nw);
+                path.pop_back();
+            }
+        }
+
+        static unsigned long long nanoseconds_since(
+            std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+
+        void count_search(unsigned int pos,
+                          std::chrono::steady_clock::time_point start)
+        {
+            unsigned long long nanoseconds = nanoseconds_since(start);
+            if (best_pos == pos) {
+                profiler->count_search(NO_PATTERN, arcs_followed, nanoseconds);
+                return;
+            }
+            PatternId id = NO_PATTERN;
+            for (DoubleTape::const_iterator it = best_path.begin();
+                 it != best_path.end(); ++it) {
+                if (container.alphabet.is_end_tag(it->output)) {
+                    id = profiler->end_tag_id(it->output);
+                }
+            }
+            profiler->count_hit(id);
+            profiler->count_search(id, arcs_followed - best_path.size(),
+                                   nanoseconds);
+        }
+
+        void walk(TransitionTableIndex state, unsigned int pos, Weight w)
+        {
+            bool final;
+            Weight final_weight;
+            if (PmatchTransducer::indexes_transition_table(state)) {
+                const TransitionW & head = toplevel->transition_table[
+                    state - TRANSITION_TARGET_TABLE_START];
+                final = head.final();
+                final_weight = head.get_weight();
+            } else {
+                final = toplevel->index_table[state].final();
+                final_weight = toplevel->index_table[state].final_weight();
+            }
+            if (final && pos != start_pos) {
+                note_final(pos, w + final_weight);
+            }
+            take_arcs(state, 0, pos, w);
+            SymbolNumber sym = pos < input->size() ?
+                (*input)[pos] : NO_SYMBOL_NUMBER;
+            if (sym != NO_SYMBOL_NUMBER && sym != 0) {
+                take_arcs(state, sym, pos, w);
+            }
+        }
+
+    public:
+        PmatchBacktrackingRunner(PmatchContainer & c):
+            container(c), toplevel(c.toplevel), applicable(false),
+            profiler(NULL), input(NULL), start_pos(0), best_pos(0),
+            best_weight(0.0), weight_limit(INFINITE_WEIGHT), arcs_followed(0)
+        {
+            applicable = detect();
+        }
+
+        // Count the searches of match() in @a p, or stop counting if NULL.
+        // @a p must have been made for the same container.
+        void set_profiler(PmatchProfiler * p) { profiler = p; }
+
+        // Whether the grammar is simple enough for this runner
+        bool is_applicable(void) const { return applicable; }
+
+        // Whether the container's current settings shape the output or
+        // need bookkeeping that only PmatchContainer::match() does
+        bool needs_container(void) const
+        {
+            return container.locate_mode || container.count_patterns ||
+                container.profile_mode || container.extract_patterns ||
+                container.delete_patterns || container.mark_patterns ||
+                container.xerox_composition;
+        }
+
+        // Like PmatchContainer::match(). Falls back to it when the grammar or
+        // the container's current settings need the full machinery, and when
+        // a time cutoff is given, as the fast path does not keep time.
+        std::string match(const std::string & input_str,
+                          double time_cutoff = 0.0,
+                          Weight weight_cutoff = INFINITE_WEIGHT)
+        {
+            if (!applicable || needs_container() || time_cutoff > 0.0) {
+                return container.match(input_str, time_cutoff, weight_cutoff);
+            }
+            container.initialize_input(input_str.c_str());
+            input = &container.input;
+            weight_limit = weight_cutoff;
+            DoubleTape result;
+            unsigned int pos = 0;
+            std::chrono::steady_clock::time_point call_start;
+            if (profiler != NULL) {
+                call_start = std::chrono::steady_clock::now();
+            }
+            while (pos < input->size() && (*input)[pos] != NO_SYMBOL_NUMBER) {
+                path.clear();
+                best_path.clear();
+                start_pos = pos;
+                best_pos = pos;
+                best_weight = INFINITE_WEIGHT;
+                arcs_followed = 0;
+                std::chrono::steady_clock::time_point search_start;
+                if (profiler != NULL) {
+                    search_start = std::chrono::steady_clock::now();
+                }
+                walk(0, pos, 0.0);
+                if (profiler != NULL) {
+                    count_search(pos, search_start);
+                }
+                if (best_pos != pos) {
+                    result.insert(result.end(),
+                                  best_path.begin(), best_path.end());
+                    pos = best_pos;
+                } else {
+                    result.push_back(SymbolPair((*input)[pos], (*input)[pos]));
+                    ++pos;
+                }
+            }
+            input = NULL;
+            if (profiler != NULL) {
+                profiler->count_call(nanoseconds_since(call_start));
+            }
+            return container.alphabet.stringify(result);
+        }
+    };
+
+}
+
+#endif //_HFST_OL_TRANSDUCER_PMATCH_BACKTRACK_H_
@@ -0,0 +1,403 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+#ifndef _HFST_OL_TRANSDUCER_PMATCH_LITERALS_H_
+#define _HFST_OL_TRANSDUCER_PMATCH_LITERALS_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <istream>
+#include <algorithm>
+#include "pmatch.h"
+
+namespace hfst_ol {
+
+    const unsigned int NO_LITERAL = UINT_MAX;
+
+// An Aho-Corasick automaton over the utf-8 bytes of the literal strings of a
+// pmatch grammar. Grammars that are mostly gazetteers (@txt and @bin lists)
+// can only match where one of their literals occurs, so one linear pass
+// over the input finds every span that could possibly match, and full
+// pmatch only needs to run around those spans.
+    class PmatchLiteralPrefilter
+    {
+    public:
+        struct Candidate
+        {
+            size_t start;
+            size_t length;
+            unsigned int literal;
+        };
+        typedef std::vector<Candidate> CandidateVector;
+
+    protected:
+        struct Edge
+        {
+            unsigned char byte;
+            unsigned int target;
+            bool operator<(const Edge & rhs) const
+                { return byte < rhs.byte; }
+        };
+
+        struct Node
+        {
+            // Sorted by byte, searched with lower_bound
+            std::vector<Edge> edges;
+            unsigned int fail;
+            // The literal that ends in this node, if any
+            unsigned int literal;
+            // The nearest node on the fail chain that ends a literal
+            unsigned int dictionary_link;
+            Node(void):
+                fail(0), literal(NO_LITERAL), dictionary_link(0) {}
+        };
+
+        std::vector<Node> nodes;
+        // The root is by far the most visited node, so it gets a dense table
+        std::vector<unsigned int> root_edges;
+        StringVector literals;
+        size_t max_literal_length;
+        bool compiled;
+        bool all_rules_literal;
+
+        unsigned int find_edge(unsigned int node, unsigned char byte) const
+        {
+            if (node == 0) {
+                return root_edges[byte];
+            }
+            const std::vector<Edge> & edges = nodes[node].edges;
+            Edge key;
+            key.byte = byte;
+            std::vector<Edge>::const_iterator it =
+                std::lower_bound(edges.begin(), edges.end(), key);
+            if (it != edges.end() && it->byte == byte) {
+                return it->target;
+            }
+            return 0;
+        }
+
+        unsigned int add_edge(unsigned int node, unsigned char byte)
+        {
+            unsigned int target = (unsigned int)nodes.size();
+            nodes.push_back(Node());
+            if (node == 0) {
+                root_edges[byte] = target;
+            }
+            Edge edge;
+            edge.byte = byte;
+            edge.target = target;
+            std::vector<Edge> & edges = nodes[node].edges;
+            edges.insert(std::upper_bound(edges.begin(), edges.end(), edge),
+                         edge);
+            return target;
+        }
+
+        unsigned int step(unsigned int node, unsigned char byte) const
+        {
+            unsigned int next = find_edge(node, byte);
+            while (next == 0 && node != 0) {
+                node = nodes[node].fail;
+                next = find_edge(node, byte);
+            }
+            return next;
+        }
+
+        // Collect the input sides of all paths of an acyclic rule. Returns
+        // false if the rule is cyclic or has an input symbol that is not
+        // literal text.
+        static bool collect_paths(
+            const hfst::implementations::HfstBasicTransducer & fsm,
+            hfst::implementations::HfstState state,
+            std::string & prefix,
+            std::vector<bool> & on_path,
+            StringVector & paths)
+        {
+            if (on_path[state]) {
+                return false;
+            }
+            if (fsm.is_final_state(state) && prefix.size() != 0) {
+                paths.push_back(prefix);
+            }
+            on_path[state] = true;
+            const hfst::implementations::HfstBasicTransitions & transitions =
+                fsm[state];
+            for (hfst::implementations::HfstBasicTransitions::const_iterator it =
+                     transitions.begin(); it != transitions.end(); ++it) {
+                std::string symbol = it->get_input_symbol();
+                size_t prefix_length = prefix.size();
+                if (hfst::is_epsilon(symbol) ||
+                    symbol == "@PMATCH_ENTRY@" || symbol == "@PMATCH_EXIT@" ||
+                    PmatchAlphabet::is_end_tag(symbol)) {
+                    // Markup that doesn't consume input
+                } else if (hfst::is_unknown(symbol) ||
+                           hfst::is_identity(symbol) ||
+                           hfst::is_default(symbol) ||
+                           PmatchAlphabet::is_special(symbol) ||
+                           hfst::FdOperation::is_diacritic(symbol)) {
+                    on_path[state] = false;
+                    return false;
+                } else {
+                    prefix.append(symbol);
+                }
+                if (!collect_paths(fsm, it->get_target_state(),
+                                   prefix, on_path, paths)) {
+                    on_path[state] = false;
+                    return false;
+                }
+                prefix.resize(prefix_length);
+            }
+            on_path[state] = false;
+            return true;
+        }
+
+    public:
+        PmatchLiteralPrefilter(void):
+            nodes(1), root_edges(UCHAR_MAX + 1, 0),
+            max_literal_length(0), compiled(true), all_rules_literal(true)
+            {}
+
+        PmatchLiteralPrefilter(const StringVector & strings):
+            nodes(1), root_edges(UCHAR_MAX + 1, 0),
+            max_literal_length(0), compiled(false), all_rules_literal(true)
+            {
+                for (StringVector::const_iterator it = strings.begin();
+                     it != strings.end(); ++it) {
+                    add_literal(*it);
+                }
+                compile();
+            }
+
+        /** Add \a literal to the automaton and return its number. Adding
+            the same literal twice returns the same number. The empty string
+            is not a literal and returns NO_LITERAL. */
+        unsigned int add_literal(const std::string & literal)
+        {
+            if (literal.size() == 0) {
+                return NO_LITERAL;
+            }
+            unsigned int node = 0;
+            for (std::string::const_iterator it = literal.begin();
+                 it != literal.end(); ++it) {
+                unsigned char byte = (unsigned char)*it;
+                unsigned int next = find_edge(node, byte);
+                if (next == 0) {
+                    next = add_edge(node, byte);
+                }
+                node = next;
+            }
+            if (nodes[node].literal == NO_LITERAL) {
+                nodes[node].literal = (unsigned int)literals.size();
+                literals.push_back(literal);
+                max_literal_length = std::max(max_literal_length,
+                                              literal.size());
+                compiled = false;
+            }
+            return nodes[node].literal;
+        }
+
+        /** Add every line of \a is as a literal, as the @txt list
+            construct does. */
+        void add_literals_from(std::istream & is)
+        {
+            std::string line;
+            while (std::getline(is, line)) {
+                if (line.size() != 0 && line[line.size() - 1] == '\r') {
+                    line.resize(line.size() - 1);
+                }
+                add_literal(line);
+            }
+        }
+
+        /** Add the literals of the compiled pmatch rule \a rule. If the rule
+            is not a finite list of literal strings, nothing is added, false
+            is returned and the prefilter no longer covers the whole
+            grammar. */
+        bool add_rule(const hfst::HfstTransducer & rule)
+        {
+            hfst::implementations::HfstBasicTransducer fsm(rule);
+            StringVector paths;
+            std::string prefix;
+            std::vector<bool> on_path(fsm.get_max_state() + 1, false);
+            if (!collect_paths(fsm, 0, prefix, on_path, paths)) {
+                all_rules_literal = false;
+                return false;
+            }
+            for (StringVector::const_iterator it = paths.begin();
+                 it != paths.end(); ++it) {
+                add_literal(*it);
+            }
+            return true;
+        }
+
+        /** Build the failure links. Called automatically before searching
+            if literals have been added since the last call. */
+        void compile(void)
+        {
+            std::deque<unsigned int> agenda;
+            for (std::vector<Edge>::const_iterator it = nodes[0].edges.begin();
+                 it != nodes[0].edges.end(); ++it) {
+                nodes[it->target].fail = 0;
+                nodes[it->target].dictionary_link = 0;
+                agenda.push_back(it->target);
+            }
+            while (!agenda.empty()) {
+                unsigned int node = agenda.front();
+                agenda.pop_front();
+                for (std::vector<Edge>::const_iterator it =
+                         nodes[node].edges.begin();
+                     it != nodes[node].edges.end(); ++it) {
+                    unsigned int fail = step(nodes[node].fail, it->byte);
+                    Node & child = nodes[it->target];
+                    child.fail = fail;
+                    child.dictionary_link =
+                        (nodes[fail].literal != NO_LITERAL) ?
+                        fail : nodes[fail].dictionary_link;
+                    agenda.push_back(it->target);
+                }
+            }
+            compiled = true;
+        }
+
+        bool empty(void) const { return literals.size() == 0; }
+        size_t literal_count(void) const { return literals.size(); }
+        size_t get_max_literal_length(void) const
+            { return max_literal_length; }
+        const std::string & get_literal(unsigned int literal) const
+            { return literals[literal]; }
+        /** Whether every rule given to add_rule was a literal list, ie.
+            whether input without candidates is guaranteed not to match. */
+        bool covers_all_rules(void) const { return all_rules_literal; }
+
+        /** Whether \a container is set to produce something other than the
+            input with the matches rewritten, so that text outside the
+            matches can't be copied through as it is. */
+        static bool shapes_output(const PmatchContainer & container)
+        {
+            return container.locate_mode || container.extract_patterns ||
+                container.delete_patterns || container.mark_patterns;
+        }
+
+        /** All occurrences of all literals in \a input, ordered by end
+            position and, for a shared end, from longest to shortest. */
+        CandidateVector find_candidates(const std::string & input)
+        {
+            if (!compiled) {
+                compile();
+            }
+            CandidateVector candidates;
+            unsigned int node = 0;
+            for (size_t i = 0; i < input.size(); ++i) {
+                node = step(node, (unsigned char)input[i]);
+                unsigned int hit = (nodes[node].literal != NO_LITERAL) ?
+                    node : nodes[node].dictionary_link;
+                while (hit != 0) {
+                    Candidate candidate;
+                    candidate.literal = nodes[hit].literal;
+                    candidate.length = literals[candidate.literal].size();
+                    candidate.start = i + 1 - candidate.length;
+                    candidates.push_back(candidate);
+                    hit = nodes[hit].dictionary_link;
+                }
+            }
+            return candidates;
+        }
+
+        /** Whether any literal occurs in \a input. */
+        bool has_candidate(const std::string & input)
+        {
+            if (!compiled) {
+                compile();
+            }
+            unsigned int node = 0;
+            for (size_t i = 0; i < input.size(); ++i) {
+                node = step(node, (unsigned char)input[i]);
+                if (nodes[node].literal != NO_LITERAL ||
+                    nodes[node].dictionary_link != 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    inline bool is_prefilter_cut_point(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+/** Run \a container over \a input only in the neighbourhood of the
+    candidate spans of \a prefilter, copying the rest of the input through
+    as pmatch itself would. Windows around candidates are widened by the
+    container's maximum context length and cut only at whitespace, so
+    boundaries and contexts see the same text they would in a full run.
+
+    This is only equivalent to container.match(input) when every match of
+    the grammar starts with one of the literals, so the whole input is
+    given to container.match() unless prefilter.covers_all_rules() holds.
+    The whole input is also matched when the container is set to extract,
+    delete or mark the matches, or to locate them. */
+    inline std::string prefiltered_match(PmatchContainer & container,
+                                         PmatchLiteralPrefilter & prefilter,
+                                         const std::string & input,
+                                         double time_cutoff = 0.0)
+    {
+        if (!prefilter.covers_all_rules() ||
+            PmatchLiteralPrefilter::shapes_output(container)) {
+            return container.match(input, time_cutoff);
+        }
+        PmatchLiteralPrefilter::CandidateVector candidates =
+            prefilter.find_candidates(input);
+        if (candidates.size() == 0) {
+            return input;
+        }
+        // Context lengths count symbols, a utf-8 symbol is at most 4 bytes
+        size_t margin = 4 * container.get_max_context();
+        std::vector<std::pair<size_t, size_t> > windows;
+        for (PmatchLiteralPrefilter::CandidateVector::const_iterator it =
+                 candidates.begin(); it != candidates.end(); ++it) {
+            size_t begin = (it->start > margin) ? it->start - margin : 0;
+            size_t end = std::min(input.size(),
+                                  it->start + it->length + margin);
+            while (begin > 0 && !is_prefilter_cut_point(input[begin - 1])) {
+                --begin;
+            }
+            while (end < input.size() && !is_prefilter_cut_point(input[end])) {
+                ++end;
+            }
+            windows.push_back(std::pair<size_t, size_t>(begin, end));
+        }
+        // Candidates come ordered by their end, a long one may start first
+        std::sort(windows.begin(), windows.end());
+        std::string retval;
+        size_t copied = 0;
+        for (std::vector<std::pair<size_t, size_t> >::const_iterator it =
+                 windows.begin(); it != windows.end(); ++it) {
+            if (it->second <= copied) {
+                continue;
+            }
+            size_t begin = std::max(it->first, copied);
+            size_t end = it->second;
+            // Overlapping windows are run as one
+            while (it + 1 != windows.end() && (it + 1)->first <= end) {
+                ++it;
+                end = std::max(end, it->second);
+            }
+            retval.append(input, copied, begin - copied);
+            retval.append(container.match(
+                              input.substr(begin, end - begin),
+                              time_cutoff));
+            copied = end;
+        }
+        retval.append(input, copied, std::string::npos);
+        return retval;
+    }
+
+}
+
+#endif //_HFST_OL_TRANSDUCER_PMATCH_LITERALS_H_
@@ -0,0 +1,382 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+#ifndef _HFST_OL_TRANSDUCER_PMATCH_PROFILE_H_
+#define _HFST_OL_TRANSDUCER_PMATCH_PROFILE_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <sstream>
+#include <iomanip>
+#include "pmatch.h"
+
+namespace hfst_ol {
+
+    typedef unsigned int PatternId;
+    const PatternId NO_PATTERN = UINT_MAX;
+
+// Pattern counting and profiling keyed by dense pattern ids. The ids are
+// assigned once, from the end tags of the container's alphabet, and the
+// tag-to-id tables are not modified afterwards, so lookups need no locking.
+// Every thread counts into its own slot of counters; slots are only summed
+// up when a report is requested.
+//
+// Nothing is counted by PmatchContainer::match(), locate() or process()
+// themselves, which are in the library. Counts come from two places:
+//
+// - The locate() wrapper below counts what container.locate() returns:
+//   hits and alternatives per pattern. The tag of a Location is a string,
+//   so it is hashed once per token. The time of a call is only measured
+//   as a whole, and apportioned_seconds shares it between the matched
+//   patterns by the number of bytes they matched. It is an estimate.
+//
+// - PmatchBacktrackingRunner::match(), when given a profiler, does its own
+//   search and counts it: hits, backtracks and search_seconds, the
+//   measured time of the searches at the positions where the pattern
+//   matched. It maps end tag symbols to ids with a table, without strings.
+//   Searches that match nothing are counted as unattributed.
+    class PmatchProfiler
+    {
+    public:
+        struct PatternStats
+        {
+            unsigned long long hits;
+            unsigned long long alternatives;
+            unsigned long long backtracks;
+            double search_seconds;
+            double apportioned_seconds;
+        };
+
+    protected:
+        struct Counters
+        {
+            std::atomic<unsigned long long> hits;
+            std::atomic<unsigned long long> alternatives;
+            std::atomic<unsigned long long> backtracks;
+            std::atomic<unsigned long long> search_nanoseconds;
+            std::atomic<unsigned long long> apportioned_nanoseconds;
+        };
+
+        struct ThreadSlot
+        {
+            std::unique_ptr<Counters[]> counters;
+            std::atomic<unsigned long long> calls;
+            std::atomic<unsigned long long> nanoseconds;
+            std::atomic<unsigned long long> unregistered_hits;
+            std::atomic<unsigned long long> unattributed_backtracks;
+            std::atomic<unsigned long long> unattributed_nanoseconds;
+        };
+
+        std::vector<std::string> names;
+        std::unordered_map<std::string, PatternId> ids;
+        // By end tag symbol
+        std::vector<PatternId> end_tag_ids;
+        std::vector<std::unique_ptr<ThreadSlot> > slots;
+        std::unordered_map<std::thread::id, ThreadSlot *> thread_slots;
+        mutable std::mutex slots_mutex;
+        unsigned long serial;
+
+        static unsigned long next_serial(void)
+        {
+            static std::atomic<unsigned long> counter(0);
+            return ++counter;
+        }
+
+        static void relaxed_add(std::atomic<unsigned long long> & a,
+                                unsigned long long n)
+        {
+            a.store(a.load(std::memory_order_relaxed) + n,
+                    std::memory_order_relaxed);
+        }
+
+        void clear_slot(ThreadSlot & slot)
+        {
+            for (size_t i = 0; i < names.size(); ++i) {
+                slot.counters[i].hits = 0;
+                slot.counters[i].alternatives = 0;
+                slot.counters[i].backtracks = 0;
+                slot.counters[i].search_nanoseconds = 0;
+                slot.counters[i].apportioned_nanoseconds = 0;
+            }
+            slot.calls = 0;
+            slot.nanoseconds = 0;
+            slot.unregistered_hits = 0;
+            slot.unattributed_backtracks = 0;
+            slot.unattributed_nanoseconds = 0;
+        }
+
+        ThreadSlot * new_slot(void)
+        {
+            ThreadSlot * slot = new ThreadSlot;
+            slot->counters.reset(new Counters[names.size()]);
+            clear_slot(*slot);
+            slots.push_back(std::unique_ptr<ThreadSlot>(slot));
+            return slot;
+        }
+
+        // The calling thread's slot. The profiler keeps the slots of the
+        // threads by thread id, and each thread remembers the slot of the
+        // last profiler it used, so nothing outlives the profiler. The
+        // serial number keeps a new profiler at a recycled address from
+        // picking up a stale slot.
+        ThreadSlot & local_slot(void)
+        {
+            struct LastSlot
+            {
+                unsigned long serial;
+                ThreadSlot * slot;
+            };
+            thread_local LastSlot last = { 0, NULL };
+            if (last.serial == serial) {
+                return *last.slot;
+            }
+            std::lock_guard<std::mutex> lock(slots_mutex);
+            ThreadSlot *& slot = thread_slots[std::this_thread::get_id()];
+            if (slot == NULL) {
+                slot = new_slot();
+            }
+            last.serial = serial;
+            last.slot = slot;
+            return *slot;
+        }
+
+        static std::string json_escape(const std::string & str)
+        {
+            std::ostringstream os;
+            for (std::string::const_iterator it = str.begin();
+                 it != str.end(); ++it) {
+                unsigned char c = *it;
+                if (c == '"' || c == '\\') {
+                    os << '\\' << c;
+                } else if (c < 0x20) {
+                    os << "\\u" << std::hex << std::setw(4)
+                       << std::setfill('0') << static_cast<int>(c)
+                       << std::dec;
+                } else {
+                    os << c;
+                }
+            }
+            return os.str();
+        }
+
+    public:
+        PmatchProfiler(const PmatchContainer & container): serial(next_serial())
+        {
+            const PmatchAlphabet & alphabet = container.get_alphabet();
+            for (std::map<SymbolNumber, std::string>::const_iterator it =
+                     alphabet.end_tag_map.begin();
+                 it != alphabet.end_tag_map.end(); ++it) {
+                if (ids.count(it->second) == 0) {
+                    ids[it->second] = names.size();
+                    names.push_back(it->second);
+                }
+                if (it->first >= end_tag_ids.size()) {
+                    end_tag_ids.resize(it->first + 1, NO_PATTERN);
+                }
+                end_tag_ids[it->first] = ids[it->second];
+            }
+        }
+
+        size_t pattern_count(void) const { return names.size(); }
+
+        PatternId get_id(const std::string & tag) const
+        {
+            std::unordered_map<std::string, PatternId>::const_iterator it =
+                ids.find(tag);
+            return it == ids.end() ? NO_PATTERN : it->second;
+        }
+
+        // The id of the pattern of end tag symbol @a sym
+        PatternId end_tag_id(SymbolNumber sym) const
+        {
+            return sym < end_tag_ids.size() ? end_tag_ids[sym] : NO_PATTERN;
+        }
+
+        const std::string & get_name(PatternId id) const
+            { return names.at(id); }
+
+        void count_hit(PatternId id, unsigned long alternatives = 1)
+        {
+            ThreadSlot & slot = local_slot();
+            if (id >= names.size()) {
+                relaxed_add(slot.unregistered_hits, 1);
+                return;
+            }
+            relaxed_add(slot.counters[id].hits, 1);
+            relaxed_add(slot.counters[id].alternatives, alternatives);
+        }
+
+        // Count a search at one start position by a matcher that searches
+        // itself. @a id is the pattern that matched, or NO_PATTERN if
+        // nothing did; @a backtracks is the number of arcs it followed that
+        // are not on the kept match.
+        void count_search(PatternId id, unsigned long long backtracks,
+                          unsigned long long nanoseconds)
+        {
+            ThreadSlot & slot = local_slot();
+            if (id >= names.size()) {
+                relaxed_add(slot.unattributed_backtracks, backtracks);
+                relaxed_add(slot.unattributed_nanoseconds, nanoseconds);
+                return;
+            }
+            relaxed_add(slot.counters[id].backtracks, backtracks);
+            relaxed_add(slot.counters[id].search_nanoseconds, nanoseconds);
+        }
+
+        // Count a call of a matcher that took @a nanoseconds
+        void count_call(unsigned long long nanoseconds)
+        {
+            ThreadSlot & slot = local_slot();
+            relaxed_add(slot.calls, 1);
+            relaxed_add(slot.nanoseconds, nanoseconds);
+        }
+
+        // Run container.locate() and count the result. Each matched token
+        // counts a hit for its pattern, with the number of analyses as
+        // alternatives, and the time of the call is apportioned between the
+        // matched patterns by the number of bytes they matched.
+        LocationVectorVector locate(PmatchContainer & container,
+                                    const std::string & input,
+                                    double time_cutoff = 0.0,
+                                    Weight weight_cutoff = INFINITE_WEIGHT)
+        {
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            LocationVectorVector locations =
+                container.locate(input, time_cutoff, weight_cutoff);
+            unsigned long long elapsed =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+            count_call(elapsed);
+            ThreadSlot & slot = local_slot();
+            size_t matched_bytes = 0;
+            for (LocationVectorVector::const_iterator it = locations.begin();
+                 it != locations.end(); ++it) {
+                if (it->size() != 0 && it->at(0).output != "@_NONMATCHING_@") {
+                    matched_bytes += it->at(0).input.size();
+                }
+            }
+            for (LocationVectorVector::const_iterator it = locations.begin();
+                 it != locations.end(); ++it) {
+                if (it->size() == 0 || it->at(0).output == "@_NONMATCHING_@") {
+                    continue;
+                }
+                PatternId id = get_id(it->at(0).tag);
+                count_hit(id, it->size());
+                if (id != NO_PATTERN && matched_bytes != 0) {
+                    relaxed_add(slot.counters[id].apportioned_nanoseconds,
+                                elapsed * it->at(0).input.size()
+                                / matched_bytes);
+                }
+            }
+            return locations;
+        }
+
+        // Sum up the counters of all threads
+        std::vector<PatternStats> merge(void) const
+        {
+            std::vector<PatternStats> retval(names.size());
+            for (size_t i = 0; i < names.size(); ++i) {
+                retval[i].hits = 0;
+                retval[i].alternatives = 0;
+                retval[i].backtracks = 0;
+                retval[i].search_seconds = 0.0;
+                retval[i].apportioned_seconds = 0.0;
+            }
+            std::lock_guard<std::mutex> lock(slots_mutex);
+            for (size_t s = 0; s < slots.size(); ++s) {
+                const Counters * counters = slots[s]->counters.get();
+                for (size_t i = 0; i < names.size(); ++i) {
+                    retval[i].hits += counters[i].hits.load(
+                        std::memory_order_relaxed);
+                    retval[i].alternatives += counters[i].alternatives.load(
+                        std::memory_order_relaxed);
+                    retval[i].backtracks += counters[i].backtracks.load(
+                        std::memory_order_relaxed);
+                    retval[i].search_seconds +=
+                        counters[i].search_nanoseconds.load(
+                            std::memory_order_relaxed) / 1e9;
+                    retval[i].apportioned_seconds +=
+                        counters[i].apportioned_nanoseconds.load(
+                            std::memory_order_relaxed) / 1e9;
+                }
+            }
+            return retval;
+        }
+
+        // Zero all counters. Not to be called while other threads count.
+        void reset(void)
+        {
+            std::lock_guard<std::mutex> lock(slots_mutex);
+            for (size_t s = 0; s < slots.size(); ++s) {
+                clear_slot(*slots[s]);
+            }
+        }
+
+        // A JSON report of the merged counters, with patterns that were never
+        // hit left out unless @a include_unused is set.
+        std::string to_json(bool include_unused = false) const
+        {
+            std::vector<PatternStats> stats = merge();
+            unsigned long long calls = 0, nanoseconds = 0, unregistered = 0;
+            unsigned long long unattributed_backtracks = 0;
+            unsigned long long unattributed_nanoseconds = 0;
+            {
+                std::lock_guard<std::mutex> lock(slots_mutex);
+                for (size_t s = 0; s < slots.size(); ++s) {
+                    calls += slots[s]->calls.load(std::memory_order_relaxed);
+                    nanoseconds += slots[s]->nanoseconds.load(
+                        std::memory_order_relaxed);
+                    unregistered += slots[s]->unregistered_hits.load(
+                        std::memory_order_relaxed);
+                    unattributed_backtracks +=
+                        slots[s]->unattributed_backtracks.load(
+                            std::memory_order_relaxed);
+                    unattributed_nanoseconds +=
+                        slots[s]->unattributed_nanoseconds.load(
+                            std::memory_order_relaxed);
+                }
+            }
+            std::ostringstream os;
+            os << "{\"calls\": " << calls
+               << ", \"seconds\": " << nanoseconds / 1e9
+               << ", \"unregistered_hits\": " << unregistered
+               << ", \"unattributed_backtracks\": " << unattributed_backtracks
+               << ", \"unattributed_search_seconds\": "
+               << unattributed_nanoseconds / 1e9
+               << ", \"patterns\": [";
+            bool first = true;
+            for (size_t i = 0; i < stats.size(); ++i) {
+                if (!include_unused && stats[i].hits == 0) {
+                    continue;
+                }
+                os << (first ? "" : ", ")
+                   << "{\"name\": \"" << json_escape(names[i]) << "\""
+                   << ", \"id\": " << i
+                   << ", \"hits\": " << stats[i].hits
+                   << ", \"alternatives\": " << stats[i].alternatives
+                   << ", \"backtracks\": " << stats[i].backtracks
+                   << ", \"search_seconds\": " << stats[i].search_seconds
+                   << ", \"apportioned_seconds\": "
+                   << stats[i].apportioned_seconds << "}";
+                first = false;
+            }
+            os << "]}";
+            return os.str();
+        }
+    };
+
+}
+
+#endif //_HFST_OL_TRANSDUCER_PMATCH_PROFILE_H_
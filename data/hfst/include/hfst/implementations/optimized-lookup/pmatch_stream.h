@@ -0,0 +1,281 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+#ifndef _HFST_OL_TRANSDUCER_PMATCH_STREAM_H_
+#define _HFST_OL_TRANSDUCER_PMATCH_STREAM_H_
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <algorithm>
+#include "pmatch_tokenize.h"
+
+namespace hfst_ol_tokenize {
+
+// Runs a PmatchContainer over input that arrives in arbitrary chunks, for
+// text that has no line breaks to split on. Only the uncommitted tail of the
+// input is kept, plus a lookback of already committed text that provides
+// left context.
+//
+// A token is committed once at least lookahead_bytes of input follow it, so
+// tokens come out exactly as whole-input matching would produce them as long
+// as no match together with its right context is longer than that.
+//
+// Left context is restored from the lookback, which starts at a committed
+// token boundary at least lookback_bytes before the committed end. If the
+// tokenization of the lookback and the new input does not line up with what
+// was already committed, the lookback is extended back to earlier token
+// boundaries, up to 4 * lookback_bytes of committed text. Only if that does
+// not line up either is the new input matched without left context.
+//
+// If nothing can be committed, because one match is longer than
+// lookahead_bytes, the input is matched again only after the pending input
+// has doubled, so the work stays linear in the input. Pending input is
+// bounded by max_pending_bytes: at that size every token that starts at
+// least lookahead_bytes before the end of the input is committed as it is,
+// although a match that reaches the end of the input could still grow with
+// more input.
+class PmatchStreamMatcher {
+public:
+    PmatchStreamMatcher(hfst_ol::PmatchContainer & c,
+                        const TokenCallback & cb,
+                        const TokenizeSettings & s = TokenizeSettings(),
+                        size_t lookahead = 4096,
+                        size_t max_pending = 1 << 20):
+        container(c), callback(cb), settings(s),
+        lookahead_bytes(lookahead),
+        lookback_bytes(4 * c.get_max_context()),
+        max_pending_bytes(std::max(max_pending, 4 * lookahead)),
+        next_run_bytes(2 * lookahead),
+        stream_offset(0) {}
+
+    // Add a chunk of input. Chunks may split utf-8 sequences.
+    void feed(const char * buf, size_t len)
+    {
+        pending.append(buf, len);
+        // Wait for at least lookahead_bytes beyond the lookahead so that each
+        // run has something to commit
+        if (pending.size() >= next_run_bytes + incomplete_utf8_tail()) {
+            run(false);
+        }
+    }
+
+    void feed(const std::string & buf) { feed(buf.data(), buf.size()); }
+
+    // Match and emit everything still pending.
+    void flush(void)
+    {
+        run(true);
+        lookback.clear();
+        lookback_starts.clear();
+        next_run_bytes = 2 * lookahead_bytes;
+    }
+
+    // Bytes of input committed so far
+    uint64_t get_offset(void) const { return stream_offset; }
+
+protected:
+    hfst_ol::PmatchContainer & container;
+    TokenCallback callback;
+    TokenizeSettings settings;
+    size_t lookahead_bytes;
+    size_t lookback_bytes;
+    size_t max_pending_bytes;
+    // Size of pending at which the input is matched next
+    size_t next_run_bytes;
+    // Already committed text before stream_offset, starting at a token
+    // boundary
+    std::string lookback;
+    // Offsets in lookback of the committed tokens, ascending
+    std::vector<size_t> lookback_starts;
+    // Input from stream_offset onwards
+    std::string pending;
+    uint64_t stream_offset;
+
+    // Number of bytes at the end of pending that form an incomplete utf-8
+    // sequence and must wait for the next chunk
+    size_t incomplete_utf8_tail(void) const
+    {
+        size_t n = 0;
+        while (n < 4 && n < pending.size()) {
+            unsigned char c = pending[pending.size() - 1 - n];
+            ++n;
+            if ((c & 0xc0) != 0x80) {
+                size_t expected = 1;
+                if ((c & 0xe0) == 0xc0) { expected = 2; }
+                else if ((c & 0xf0) == 0xe0) { expected = 3; }
+                else if ((c & 0xf8) == 0xf0) { expected = 4; }
+                return expected > n ? n : 0;
+            }
+        }
+        return 0;
+    }
+
+    struct Span
+    {
+        size_t start;
+        size_t length;
+        hfst_ol::LocationVector * locations;
+    };
+
+    static void collect_spans(hfst_ol::LocationVectorVector & locations,
+                              std::vector<Span> & spans)
+    {
+        size_t offset = 0;
+        spans.clear();
+        for (auto it = locations.begin(); it != locations.end(); ++it) {
+            if (it->size() == 0) {
+                continue;
+            }
+            Span span = {offset, it->at(0).input.size(), &(*it)};
+            spans.push_back(span);
+            offset += span.length;
+        }
+    }
+
+    static bool aligned_at(const std::vector<Span> & spans, size_t pos)
+    {
+        for (auto it = spans.begin(); it != spans.end(); ++it) {
+            if (it->start == pos) {
+                return true;
+            }
+            if (it->start > pos) {
+                return false;
+            }
+        }
+        return pos == 0;
+    }
+
+    // The last token start in lookback with at least context bytes after
+    // it, or the first one if there is none
+    size_t lookback_start(size_t context) const
+    {
+        size_t start = 0;
+        for (auto it = lookback_starts.begin(); it != lookback_starts.end();
+             ++it) {
+            if (*it + context > lookback.size()) {
+                break;
+            }
+            start = *it;
+        }
+        return start;
+    }
+
+    void run(bool at_end)
+    {
+        size_t usable = pending.size() - (at_end ? 0 : incomplete_utf8_tail());
+        if (usable == 0) {
+            return;
+        }
+        // Try lookbacks of lookback_bytes, twice that and all that is kept,
+        // then none
+        std::vector<size_t> candidates;
+        if (!lookback.empty()) {
+            candidates.push_back(lookback_start(lookback_bytes));
+            size_t extended = lookback_start(2 * lookback_bytes);
+            if (extended != candidates.back()) {
+                candidates.push_back(extended);
+            }
+            if (candidates.back() != 0) {
+                candidates.push_back(0);
+            }
+        }
+        candidates.push_back(lookback.size());
+        hfst_ol::LocationVectorVector locations;
+        std::vector<Span> spans;
+        size_t used_start = lookback.size();
+        size_t lookback_len = 0;
+        for (auto it = candidates.begin(); it != candidates.end(); ++it) {
+            used_start = *it;
+            lookback_len = lookback.size() - used_start;
+            locations = locate(lookback.substr(used_start)
+                               + pending.substr(0, usable));
+            collect_spans(locations, spans);
+            if (lookback_len == 0 || aligned_at(spans, lookback_len)) {
+                break;
+            }
+        }
+        size_t text_end = lookback_len + usable;
+        bool forced = !at_end && pending.size() >= max_pending_bytes;
+        size_t commit_limit = at_end ? text_end :
+            (text_end > lookahead_bytes ? text_end - lookahead_bytes : 0);
+        size_t committed_end = lookback_len;
+        for (auto it = spans.begin(); it != spans.end(); ++it) {
+            size_t end = it->start + it->length;
+            if (forced ? it->start >= commit_limit : end > commit_limit) {
+                break;
+            }
+            if (it->start >= lookback_len) {
+                Token token;
+                token.byte_offset = stream_offset + (it->start - lookback_len);
+                token.byte_length = it->length;
+                token.matched = !is_nonmatching(*it->locations);
+                token.analyses = it->locations;
+                callback(token);
+                lookback_starts.push_back(used_start + it->start);
+                committed_end = end;
+            }
+        }
+        if (committed_end == lookback_len) {
+            next_run_bytes = std::min(2 * pending.size(), max_pending_bytes);
+            return;
+        }
+        next_run_bytes = 2 * lookahead_bytes;
+        size_t committed = committed_end - lookback_len;
+        lookback.append(pending, 0, committed);
+        pending.erase(0, committed);
+        stream_offset += committed;
+        // Keep the text from the last token boundary that leaves at least
+        // 4 * lookback_bytes of context
+        size_t keep_from = lookback_bytes == 0 ? lookback.size() :
+            lookback_start(4 * lookback_bytes);
+        lookback.erase(0, keep_from);
+        std::vector<size_t> starts;
+        for (auto it = lookback_starts.begin(); it != lookback_starts.end();
+             ++it) {
+            if (*it >= keep_from && *it < lookback.size() + keep_from) {
+                starts.push_back(*it - keep_from);
+            }
+        }
+        lookback_starts.swap(starts);
+    }
+
+    hfst_ol::LocationVectorVector locate(const std::string & text)
+    {
+        return container.locate(
+            text, settings.time_cutoff,
+            settings.weight_cutoff < 0.0 ?
+            hfst_ol::INFINITE_WEIGHT : settings.weight_cutoff);
+    }
+};
+
+// Stream @a instream through @a container in chunks of @a buffer_size bytes,
+// calling @a callback for each token.
+inline void process_stream(hfst_ol::PmatchContainer & container,
+                           std::istream & instream,
+                           const TokenCallback & callback,
+                           const TokenizeSettings & s = TokenizeSettings(),
+                           size_t buffer_size = 65536,
+                           size_t lookahead = 4096)
+{
+    PmatchStreamMatcher matcher(container, callback, s, lookahead);
+    std::vector<char> buf(buffer_size);
+    while (instream) {
+        instream.read(&buf[0], buf.size());
+        std::streamsize n = instream.gcount();
+        if (n <= 0) {
+            break;
+        }
+        matcher.feed(&buf[0], static_cast<size_t>(n));
+    }
+    matcher.flush();
+}
+
+}
+
+#endif //_HFST_OL_TRANSDUCER_PMATCH_STREAM_H_
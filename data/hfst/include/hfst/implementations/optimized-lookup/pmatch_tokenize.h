@@ -12,6 +12,10 @@
 #include <iostream>
 #include <iomanip>
 #include <iterator>
+#include <functional>
+#include <map>
+#include <cstring>
+#include <stdint.h>
 
 #include "pmatch.h"
 
@@ -53,6 +57,173 @@ void process_input(hfst_ol::PmatchContainer & container,
                    std::ostream& outstream,
                    const TokenizeSettings& s);
 
+/**
+ * A token as handed to a TokenCallback. Offsets are in bytes into the
+ * string given to locate_tokens(). For non-matching spans @a matched is
+ * false and @a analyses holds the single placeholder location pmatch
+ * produces for them.
+ */
+struct Token {
+    uint64_t byte_offset;
+    unsigned int byte_length;
+    bool matched;
+    const hfst_ol::LocationVector * analyses;
+};
+
+typedef std::function<void(const Token &)> TokenCallback;
+
+inline bool is_nonmatching(const hfst_ol::LocationVector & loc_vec) {
+    return loc_vec.size() == 0 || loc_vec[0].output == "@_NONMATCHING_@";
+}
+
+/**
+ * Run @a container over @a input_text in locate mode and call @a callback
+ * once per token, in input order, without any string formatting.
+ */
+inline void locate_tokens(hfst_ol::PmatchContainer & container,
+                          const std::string & input_text,
+                          const TokenizeSettings& s,
+                          const TokenCallback & callback) {
+    hfst_ol::LocationVectorVector locations = container.locate(
+        input_text, s.time_cutoff,
+        s.weight_cutoff < 0.0 ? hfst_ol::INFINITE_WEIGHT : s.weight_cutoff);
+    uint64_t byte_offset = 0;
+    for (auto it = locations.begin(); it != locations.end(); ++it) {
+        if (it->size() == 0) {
+            continue;
+        }
+        Token token;
+        token.byte_offset = byte_offset;
+        token.byte_length = it->at(0).input.size();
+        token.matched = !is_nonmatching(*it);
+        token.analyses = &(*it);
+        byte_offset += token.byte_length;
+        callback(token);
+    }
+}
+
+/**
+ * Writer for the binary output format. It is not an OutputFormat, which
+ * process_input() in the library switches on; write binary output with
+ * locate_and_write_binary() instead.
+ *
+ * The stream is a 4-byte magic "HOLT", a little-endian uint32 version
+ * and then a sequence of records, each a uint32 payload length, a uint8
+ * record type and the payload. All integers are little-endian; weights
+ * are IEEE 754 float32.
+ *
+ * Symbol records (type 1) carry a uint32 id followed by the UTF-8 bytes
+ * of the symbol. Each symbol is written once, before the first token
+ * record that refers to it.
+ *
+ * Token records (type 2) carry a uint64 byte offset, uint32 byte length,
+ * uint8 matched flag, uint32 input symbol count and the input symbol ids,
+ * then a uint32 analysis count and for each analysis a uint32 output
+ * symbol count, the output symbol ids and the weight.
+ *
+ * This is version 2. Version 1 had a uint32 byte offset.
+ */
+class BinaryTokenWriter {
+public:
+    enum RecordType { symbol_record = 1, token_record = 2 };
+    static const uint32_t version = 2;
+
+    BinaryTokenWriter(std::ostream & os): outstream(os) {
+        outstream.write("HOLT", 4);
+        std::string v;
+        append_uint32(v, version);
+        outstream.write(v.data(), v.size());
+    }
+
+    void write_token(const Token & token) {
+        const hfst_ol::Location & first = token.analyses->at(0);
+        payload.clear();
+        append_uint32(payload, token.byte_offset & 0xffffffff);
+        append_uint32(payload, token.byte_offset >> 32);
+        append_uint32(payload, token.byte_length);
+        payload.push_back(token.matched ? 1 : 0);
+        if (first.input_symbol_strings.size() == 0) {
+            append_uint32(payload, 1);
+            append_uint32(payload, intern(first.input));
+        } else {
+            append_symbols(first.input_symbol_strings);
+        }
+        if (!token.matched) {
+            append_uint32(payload, 0);
+        } else {
+            append_uint32(payload, token.analyses->size());
+            for (auto it = token.analyses->begin();
+                 it != token.analyses->end(); ++it) {
+                append_symbols(it->output_symbol_strings);
+                append_float(payload, it->weight);
+            }
+        }
+        write_record(token_record, payload);
+    }
+
+    void operator()(const Token & token) { write_token(token); }
+
+protected:
+    std::ostream & outstream;
+    std::map<std::string, uint32_t> symbol_ids;
+    std::string payload;
+    std::string symbol_payload;
+
+    static void append_uint32(std::string & buf, uint32_t n) {
+        for (int i = 0; i < 4; ++i) {
+            buf.push_back(static_cast<char>((n >> (8 * i)) & 0xff));
+        }
+    }
+
+    static void append_float(std::string & buf, float f) {
+        uint32_t n;
+        std::memcpy(&n, &f, sizeof(n));
+        append_uint32(buf, n);
+    }
+
+    void write_record(RecordType type, const std::string & buf) {
+        std::string head;
+        append_uint32(head, buf.size());
+        head.push_back(static_cast<char>(type));
+        outstream.write(head.data(), head.size());
+        outstream.write(buf.data(), buf.size());
+    }
+
+    uint32_t intern(const std::string & symbol) {
+        std::map<std::string, uint32_t>::iterator it =
+            symbol_ids.find(symbol);
+        if (it != symbol_ids.end()) {
+            return it->second;
+        }
+        uint32_t id = symbol_ids.size();
+        symbol_ids[symbol] = id;
+        symbol_payload.clear();
+        append_uint32(symbol_payload, id);
+        symbol_payload.append(symbol);
+        write_record(symbol_record, symbol_payload);
+        return id;
+    }
+
+    void append_symbols(const std::vector<std::string> & symbols) {
+        append_uint32(payload, symbols.size());
+        for (auto it = symbols.begin(); it != symbols.end(); ++it) {
+            append_uint32(payload, intern(*it));
+        }
+    }
+};
+
+/**
+ * Binary counterpart of match_and_print(): locate tokens in
+ * @a input_text and write them to @a writer.
+ */
+inline void locate_and_write_binary(hfst_ol::PmatchContainer & container,
+                                    BinaryTokenWriter & writer,
+                                    const std::string & input_text,
+                                    const TokenizeSettings& s) {
+    locate_tokens(container, input_text, s,
+                  [&writer](const Token & token) { writer.write_token(token); });
+}
+
 }
 
 inline std::size_t find_first_not_of_def(const std::string & str, char c, std::size_t def) {
@@ -0,0 +1,268 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+#ifndef _HFST_OL_PROFILE_ORDER_H_
+#define _HFST_OL_PROFILE_ORDER_H_
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <algorithm>
+#include <cstdlib>
+#include "../HfstBasicTransducer.h"
+#include "../../HfstTokenizer.h"
+
+namespace hfst_ol {
+
+    // Visit count of each state, indexed by state number
+    typedef std::vector<unsigned long> StateVisitProfile;
+
+// Counts how often each state of a transducer is visited when looking up
+// sample words on its input side. Epsilon and flag diacritic arcs are
+// followed without checking the flags, so the counts are an upper bound of
+// what an optimized-lookup transducer would visit.
+    class StateVisitProfiler
+    {
+    protected:
+        typedef hfst::implementations::HfstBasicTransducer BasicTransducer;
+        typedef hfst::implementations::HfstBasicTransitions BasicTransitions;
+
+        const BasicTransducer & fsm;
+        hfst::HfstTokenizer tokenizer;
+        std::set<std::string> input_symbols;
+        StateVisitProfile counts;
+
+        // Current states, with a membership mark per state
+        std::vector<hfst::implementations::HfstState> current;
+        std::vector<hfst::implementations::HfstState> next;
+        std::vector<char> in_current;
+        std::vector<char> in_next;
+
+        static bool is_epsilon_like(const std::string & symbol)
+        {
+            return hfst::is_epsilon(symbol) ||
+                hfst::FdOperation::is_diacritic(symbol);
+        }
+
+        // Add the epsilon closure of the current states to them
+        void close_current(void)
+        {
+            for (size_t i = 0; i < current.size(); ++i) {
+                const BasicTransitions & arcs = fsm.transitions(current[i]);
+                for (BasicTransitions::const_iterator it = arcs.begin();
+                     it != arcs.end(); ++it) {
+                    hfst::implementations::HfstState target =
+                        it->get_target_state();
+                    if (!in_current[target] &&
+                        is_epsilon_like(it->get_input_symbol())) {
+                        in_current[target] = 1;
+                        current.push_back(target);
+                    }
+                }
+            }
+        }
+
+        bool matches(const std::string & arc_symbol,
+                     const std::string & symbol) const
+        {
+            if (arc_symbol == symbol) {
+                return true;
+            }
+            return input_symbols.count(symbol) == 0 &&
+                (arc_symbol == hfst::internal_identity ||
+                 arc_symbol == hfst::internal_unknown);
+        }
+
+    public:
+        StateVisitProfiler(const BasicTransducer & t):
+            fsm(t), counts(t.get_max_state() + 1, 0)
+        {
+            input_symbols = t.get_input_symbols();
+            for (std::set<std::string>::const_iterator it =
+                     input_symbols.begin(); it != input_symbols.end(); ++it) {
+                if (it->size() > 1 && !hfst::is_epsilon(*it)) {
+                    tokenizer.add_multichar_symbol(*it);
+                }
+            }
+            in_current.assign(counts.size(), 0);
+            in_next.assign(counts.size(), 0);
+        }
+
+        // Look up @a word, counting each state visited @a frequency times.
+        void add_word(const std::string & word, unsigned long frequency = 1)
+        {
+            hfst::StringVector symbols = tokenizer.tokenize_one_level(word);
+            current.assign(1, 0);
+            in_current[0] = 1;
+            for (size_t pos = 0; ; ++pos) {
+                close_current();
+                for (size_t i = 0; i < current.size(); ++i) {
+                    counts[current[i]] += frequency;
+                }
+                if (pos == symbols.size()) {
+                    break;
+                }
+                next.clear();
+                for (size_t i = 0; i < current.size(); ++i) {
+                    const BasicTransitions & arcs = fsm.transitions(current[i]);
+                    for (BasicTransitions::const_iterator it = arcs.begin();
+                         it != arcs.end(); ++it) {
+                        hfst::implementations::HfstState target =
+                            it->get_target_state();
+                        if (!in_next[target] &&
+                            matches(it->get_input_symbol(), symbols[pos])) {
+                            in_next[target] = 1;
+                            next.push_back(target);
+                        }
+                    }
+                }
+                for (size_t i = 0; i < current.size(); ++i) {
+                    in_current[current[i]] = 0;
+                }
+                for (size_t i = 0; i < next.size(); ++i) {
+                    in_next[next[i]] = 0;
+                    in_current[next[i]] = 1;
+                }
+                current.swap(next);
+                if (current.empty()) {
+                    break;
+                }
+            }
+            for (size_t i = 0; i < current.size(); ++i) {
+                in_current[current[i]] = 0;
+            }
+            current.clear();
+        }
+
+        // Add a corpus of one word per line. A line may give the frequency
+        // of the word after a tab.
+        void add_corpus(std::istream & is)
+        {
+            std::string line;
+            while (std::getline(is, line)) {
+                unsigned long frequency = 1;
+                size_t tab = line.find('\t');
+                if (tab != std::string::npos) {
+                    frequency = std::strtoul(line.c_str() + tab + 1, NULL, 10);
+                    line.erase(tab);
+                }
+                if (!line.empty() && frequency != 0) {
+                    add_word(line, frequency);
+                }
+            }
+        }
+
+        const StateVisitProfile & get_profile(void) const { return counts; }
+    };
+
+/**
+ * Renumber the states of @a t so that frequently visited states come first,
+ * with each hot state followed by its hottest successor where possible.
+ * The start state stays 0 and states missing from @a profile or never
+ * visited keep their relative order after the visited ones.
+ *
+ * The optimized-lookup converter lays out states and their transition
+ * blocks in state number order, so converting the result puts hot paths
+ * next to each other in the index and transition tables. The language and
+ * weights are not changed.
+ */
+    inline hfst::implementations::HfstBasicTransducer
+    reorder_states_by_profile(
+        const hfst::implementations::HfstBasicTransducer & t,
+        const StateVisitProfile & profile)
+    {
+        using hfst::implementations::HfstState;
+        using hfst::implementations::HfstBasicTransitions;
+        using hfst::implementations::HfstBasicTransition;
+        const HfstState state_count = t.get_max_state() + 1;
+        const HfstState unplaced = static_cast<HfstState>(-1);
+
+        std::vector<unsigned long> count(state_count, 0);
+        for (HfstState s = 0; s < state_count && s < profile.size(); ++s) {
+            count[s] = profile[s];
+        }
+        std::vector<HfstState> hot;
+        for (HfstState s = 0; s < state_count; ++s) {
+            if (count[s] != 0) {
+                hot.push_back(s);
+            }
+        }
+        std::stable_sort(hot.begin(), hot.end(),
+                         [&count](HfstState a, HfstState b) {
+                             return count[a] > count[b]; });
+
+        std::vector<HfstState> new_number(state_count, unplaced);
+        HfstState placed = 0;
+        // Place a chain of states, each followed by its hottest
+        // unplaced successor
+        auto place_chain = [&](HfstState s) {
+            while (new_number[s] == unplaced) {
+                new_number[s] = placed++;
+                const HfstBasicTransitions & arcs = t.transitions(s);
+                HfstState best = unplaced;
+                for (HfstBasicTransitions::const_iterator it = arcs.begin();
+                     it != arcs.end(); ++it) {
+                    HfstState target = it->get_target_state();
+                    if (new_number[target] == unplaced && count[target] != 0 &&
+                        (best == unplaced || count[target] > count[best])) {
+                        best = target;
+                    }
+                }
+                if (best == unplaced) {
+                    break;
+                }
+                s = best;
+            }
+        };
+        place_chain(0);
+        for (std::vector<HfstState>::const_iterator it = hot.begin();
+             it != hot.end(); ++it) {
+            place_chain(*it);
+        }
+        for (HfstState s = 0; s < state_count; ++s) {
+            if (new_number[s] == unplaced) {
+                new_number[s] = placed++;
+            }
+        }
+
+        hfst::implementations::HfstBasicTransducer retval;
+        retval.add_symbols_to_alphabet(t.get_alphabet());
+        retval.add_state(state_count - 1);
+        for (HfstState s = 0; s < state_count; ++s) {
+            const HfstBasicTransitions & arcs = t.transitions(s);
+            for (HfstBasicTransitions::const_iterator it = arcs.begin();
+                 it != arcs.end(); ++it) {
+                retval.add_transition(
+                    new_number[s],
+                    HfstBasicTransition(new_number[it->get_target_state()],
+                                        it->get_input_symbol(),
+                                        it->get_output_symbol(),
+                                        it->get_weight()),
+                    false);
+            }
+            if (t.is_final_state(s)) {
+                retval.set_final_weight(new_number[s], t.get_final_weight(s));
+            }
+        }
+        return retval;
+    }
+
+    // Profile @a t with the words of @a corpus and reorder it accordingly
+    inline hfst::implementations::HfstBasicTransducer
+    reorder_states_by_corpus(
+        const hfst::implementations::HfstBasicTransducer & t,
+        std::istream & corpus)
+    {
+        StateVisitProfiler profiler(t);
+        profiler.add_corpus(corpus);
+        return reorder_states_by_profile(t, profiler.get_profile());
+    }
+
+}
+
+#endif //_HFST_OL_PROFILE_ORDER_H_
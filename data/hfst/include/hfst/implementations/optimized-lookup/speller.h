@@ -0,0 +1,1114 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+#ifndef _HFST_OL_TRANSDUCER_SPELLER_H_
+#define _HFST_OL_TRANSDUCER_SPELLER_H_
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <map>
+#include <set>
+#include <unordered_set>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <list>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <iomanip>
+#include <limits>
+#include <cstring>
+#include <stdint.h>
+#include "transducer.h"
+
+namespace hfst_ol {
+
+/** \brief Limits for a best-first correction search.
+
+    \a nbest is the number of distinct corrections to return, 0 for all of
+    them. Corrections heavier than the best one by more than \a beam, or
+    heavier than \a max_weight, are not returned; negative values mean no
+    limit. \a prune_dominated turns on the visited-state table.
+*/
+struct SpellerSearchSettings
+{
+    size_t nbest;
+    Weight beam;
+    Weight max_weight;
+    bool prune_dominated;
+
+    SpellerSearchSettings(size_t n = 0, Weight b = -1.0, Weight max = -1.0,
+                          bool prune = true):
+        nbest(n), beam(b), max_weight(max), prune_dominated(prune) {}
+};
+
+/** \brief A spelling corrector over the same mutator and lexicon as Speller,
+    searching in order of weight.
+
+    Partial corrections are kept as a tree of back-pointers into a node
+    arena, and flag diacritic states are interned, so extending a search node
+    copies neither the string nor the flag state. The search stops as soon as
+    the requested corrections are known to be cheaper than everything left in
+    the frontier, which is exact as long as the mutator and lexicon have no
+    negative weights.
+
+    Many edit paths reach the same input position, mutator state, lexicon
+    state and flag state with the same correction so far; only the cheapest
+    such arrival is expanded, and every later one is dominated. With an
+    n-best limit, a product state is also expanded for at most n different
+    corrections so far, since n cheaper expansions already give n distinct
+    completions through it.
+
+    The transducers are only read, and all per-query state is local to
+    correct() and check(), so one instance can be used from several threads.
+*/
+class BestFirstSpeller
+{
+protected:
+    Transducer * mutator;
+    Transducer * lexicon;
+    SymbolNumberVector alphabet_translator;
+    std::vector<std::string> symbol_table;
+
+    struct SearchNode
+    {
+        size_t parent;
+        SymbolNumber symbol;
+        unsigned int input_state;
+        TransitionTableIndex mutator_state;
+        TransitionTableIndex lexicon_state;
+        unsigned int flag_state;
+        // Interned correction so far, 0 for the empty string
+        unsigned int prefix;
+        Weight weight;
+        // Whether this node stands for a finished correction, with the final
+        // weights already added
+        bool complete;
+    };
+
+    struct NodeOrder
+    {
+        const std::vector<SearchNode> * nodes;
+        bool operator()(size_t lhs, size_t rhs) const
+            { return (*nodes)[lhs].weight > (*nodes)[rhs].weight; }
+    };
+
+    struct StateKey
+    {
+        unsigned int input_state;
+        TransitionTableIndex mutator_state;
+        TransitionTableIndex lexicon_state;
+        unsigned int flag_state;
+        unsigned int prefix;
+
+        bool operator==(const StateKey & rhs) const
+            {
+                return input_state == rhs.input_state &&
+                    mutator_state == rhs.mutator_state &&
+                    lexicon_state == rhs.lexicon_state &&
+                    flag_state == rhs.flag_state &&
+                    prefix == rhs.prefix;
+            }
+    };
+
+    struct StateKeyHash
+    {
+        size_t operator()(const StateKey & key) const
+            {
+                size_t h = key.input_state;
+                h = h * 1000003 ^ key.mutator_state;
+                h = h * 1000003 ^ key.lexicon_state;
+                h = h * 1000003 ^ key.flag_state;
+                h = h * 1000003 ^ key.prefix;
+                return h;
+            }
+    };
+
+    struct Search
+    {
+        std::vector<SymbolNumber> input;
+        std::vector<SearchNode> nodes;
+        std::priority_queue<size_t, std::vector<size_t>, NodeOrder> frontier;
+        std::vector<std::vector<hfst::FdValue> > flag_states;
+        std::map<std::vector<hfst::FdValue>, unsigned int> flag_state_ids;
+        // A trie of the corrections so far
+        std::map<std::pair<unsigned int, SymbolNumber>, unsigned int>
+        prefix_children;
+        unsigned int prefix_count;
+        std::unordered_set<StateKey, StateKeyHash> expanded;
+        std::unordered_map<StateKey, size_t, StateKeyHash> expansions;
+        bool prune_dominated;
+
+        Search(void): prefix_count(1), prune_dominated(false)
+            {
+                NodeOrder order = {&nodes};
+                frontier = std::priority_queue<size_t, std::vector<size_t>,
+                                               NodeOrder>(order);
+            }
+    };
+
+    static const size_t NO_PARENT = (size_t)-1;
+
+    SymbolNumber translate(SymbolNumber mutator_symbol) const
+    {
+        if (mutator_symbol >= alphabet_translator.size()) {
+            return NO_SYMBOL_NUMBER;
+        }
+        return alphabet_translator[mutator_symbol];
+    }
+
+    static unsigned int intern_flag_state(Search & search,
+                                          const std::vector<hfst::FdValue> & v)
+    {
+        std::map<std::vector<hfst::FdValue>, unsigned int>::iterator it =
+            search.flag_state_ids.find(v);
+        if (it != search.flag_state_ids.end()) {
+            return it->second;
+        }
+        unsigned int id = search.flag_states.size();
+        search.flag_states.push_back(v);
+        search.flag_state_ids[v] = id;
+        return id;
+    }
+
+    static StateKey state_key(const SearchNode & node, bool with_prefix)
+    {
+        StateKey key = {node.input_state, node.mutator_state,
+                        node.lexicon_state, node.flag_state,
+                        with_prefix ? node.prefix : 0};
+        return key;
+    }
+
+    static unsigned int extend_prefix(Search & search, unsigned int prefix,
+                                      SymbolNumber symbol)
+    {
+        std::pair<unsigned int, SymbolNumber> edge(prefix, symbol);
+        std::map<std::pair<unsigned int, SymbolNumber>, unsigned int>::iterator
+            it = search.prefix_children.find(edge);
+        if (it != search.prefix_children.end()) {
+            return it->second;
+        }
+        search.prefix_children[edge] = search.prefix_count;
+        return search.prefix_count++;
+    }
+
+    // Whether @a node should be expanded, recording it if so
+    static bool claim_expansion(Search & search, const SearchNode & node,
+                                size_t nbest)
+    {
+        if (!search.prune_dominated) {
+            return true;
+        }
+        if (!search.expanded.insert(state_key(node, true)).second) {
+            return false;
+        }
+        if (nbest != 0) {
+            size_t & count = search.expansions[state_key(node, false)];
+            if (count >= nbest) {
+                return false;
+            }
+            ++count;
+        }
+        return true;
+    }
+
+    void push(Search & search, const SearchNode & node) const
+    {
+        if (search.prune_dominated && !node.complete &&
+            search.expanded.count(state_key(node, true)) != 0) {
+            return;
+        }
+        search.nodes.push_back(node);
+        search.frontier.push(search.nodes.size() - 1);
+    }
+
+    SearchNode extend(Search & search, size_t parent, const SearchNode & from,
+                      SymbolNumber symbol, unsigned int input_state,
+                      TransitionTableIndex mutator_state,
+                      TransitionTableIndex lexicon_state, Weight weight) const
+    {
+        SearchNode node = from;
+        node.parent = parent;
+        node.symbol = symbol;
+        node.input_state = input_state;
+        node.mutator_state = mutator_state;
+        node.lexicon_state = lexicon_state;
+        node.weight = from.weight + weight;
+        node.complete = false;
+        if (symbol != 0 && !lexicon->is_flag(symbol)) {
+            node.prefix = extend_prefix(search, from.prefix, symbol);
+        }
+        return node;
+    }
+
+    // Follow the lexicon arcs with input @a lexicon_symbol, after a mutator
+    // step to @a mutator_state. If the symbol is not in the lexicon's
+    // original alphabet, unknown and identity arcs apply instead.
+    void queue_lexicon_arcs(Search & search, size_t index,
+                            SymbolNumber lexicon_symbol,
+                            TransitionTableIndex mutator_state,
+                            Weight mutator_weight,
+                            unsigned int input_increment) const
+    {
+        if (lexicon_symbol == NO_SYMBOL_NUMBER) {
+            return;
+        }
+        SymbolNumber candidates[3] = {lexicon_symbol,
+                                      NO_SYMBOL_NUMBER, NO_SYMBOL_NUMBER};
+        const TransducerAlphabet & alphabet = lexicon->get_alphabet();
+        if (lexicon_symbol >= alphabet.get_orig_symbol_count()) {
+            candidates[1] = alphabet.get_unknown_symbol();
+            candidates[2] = alphabet.get_identity_symbol();
+        }
+        for (int c = 0; c < 3; ++c) {
+            SymbolNumber sym = candidates[c];
+            const SearchNode node = search.nodes[index];
+            if (sym == NO_SYMBOL_NUMBER ||
+                !lexicon->has_transitions(node.lexicon_state + 1, sym)) {
+                continue;
+            }
+            TransitionTableIndex next = lexicon->next(node.lexicon_state, sym);
+            STransition i_s = lexicon->take_non_epsilons(next, sym);
+            while (i_s.symbol != NO_SYMBOL_NUMBER) {
+                SymbolNumber out = i_s.symbol;
+                if (out == alphabet.get_identity_symbol()) {
+                    out = lexicon_symbol;
+                }
+                push(search, extend(search, index, node, out,
+                                    node.input_state + input_increment,
+                                    mutator_state, i_s.index,
+                                    mutator_weight + i_s.weight));
+                ++next;
+                i_s = lexicon->take_non_epsilons(next, sym);
+            }
+        }
+    }
+
+    void lexicon_epsilons(Search & search, size_t index) const
+    {
+        const SearchNode node = search.nodes[index];
+        if (!lexicon->has_epsilons_or_flags(node.lexicon_state + 1)) {
+            return;
+        }
+        TransitionTableIndex next = lexicon->next_e(node.lexicon_state);
+        STransition i_s = lexicon->take_epsilons_and_flags(next);
+        while (i_s.symbol != NO_SYMBOL_NUMBER) {
+            SymbolNumber in = lexicon->get_transition(next).get_input_symbol();
+            if (in == 0) {
+                push(search, extend(search, index, node, i_s.symbol,
+                                    node.input_state, node.mutator_state,
+                                    i_s.index, i_s.weight));
+            } else {
+                hfst::FdState<SymbolNumber> flags(lexicon->get_fd_table());
+                flags.assign_values(search.flag_states[node.flag_state]);
+                if (flags.apply_operation(in)) {
+                    SearchNode child = extend(search, index, node, 0,
+                                              node.input_state,
+                                              node.mutator_state,
+                                              i_s.index, i_s.weight);
+                    child.flag_state =
+                        intern_flag_state(search, flags.get_values());
+                    push(search, child);
+                }
+            }
+            ++next;
+            i_s = lexicon->take_epsilons_and_flags(next);
+        }
+    }
+
+    void mutator_epsilons(Search & search, size_t index) const
+    {
+        const SearchNode node = search.nodes[index];
+        if (!mutator->has_transitions(node.mutator_state + 1, 0)) {
+            return;
+        }
+        TransitionTableIndex next_m = mutator->next(node.mutator_state, 0);
+        STransition mutator_i_s = mutator->take_epsilons(next_m);
+        while (mutator_i_s.symbol != NO_SYMBOL_NUMBER) {
+            if (mutator_i_s.symbol == 0) {
+                push(search, extend(search, index, node, 0, node.input_state,
+                                    mutator_i_s.index, node.lexicon_state,
+                                    mutator_i_s.weight));
+            } else {
+                queue_lexicon_arcs(search, index,
+                                   translate(mutator_i_s.symbol),
+                                   mutator_i_s.index, mutator_i_s.weight, 0);
+            }
+            ++next_m;
+            mutator_i_s = mutator->take_epsilons(next_m);
+        }
+    }
+
+    void consume_input(Search & search, size_t index) const
+    {
+        const SearchNode node = search.nodes[index];
+        if (node.input_state >= search.input.size()) {
+            return;
+        }
+        SymbolNumber input_sym = search.input[node.input_state];
+        SymbolNumber mutator_sym = input_sym;
+        if (!mutator->has_transitions(node.mutator_state + 1, input_sym)) {
+            const TransducerAlphabet & alphabet = mutator->get_alphabet();
+            mutator_sym = alphabet.get_identity_symbol();
+            if (mutator_sym == NO_SYMBOL_NUMBER ||
+                !mutator->has_transitions(node.mutator_state + 1,
+                                          mutator_sym)) {
+                mutator_sym = alphabet.get_unknown_symbol();
+            }
+            if (mutator_sym == NO_SYMBOL_NUMBER ||
+                !mutator->has_transitions(node.mutator_state + 1,
+                                          mutator_sym)) {
+                return;
+            }
+        }
+        TransitionTableIndex next_m = mutator->next(node.mutator_state,
+                                                    mutator_sym);
+        STransition mutator_i_s = mutator->take_non_epsilons(next_m,
+                                                             mutator_sym);
+        while (mutator_i_s.symbol != NO_SYMBOL_NUMBER) {
+            if (mutator_i_s.symbol == 0) {
+                push(search, extend(search, index, node, 0,
+                                    node.input_state + 1, mutator_i_s.index,
+                                    node.lexicon_state, mutator_i_s.weight));
+            } else {
+                SymbolNumber out = mutator_i_s.symbol;
+                if (out == mutator->get_alphabet().get_identity_symbol()) {
+                    out = input_sym;
+                }
+                queue_lexicon_arcs(search, index, translate(out),
+                                   mutator_i_s.index, mutator_i_s.weight, 1);
+            }
+            ++next_m;
+            mutator_i_s = mutator->take_non_epsilons(next_m, mutator_sym);
+        }
+    }
+
+    std::string stringify(const Search & search, size_t index) const
+    {
+        std::vector<SymbolNumber> symbols;
+        for (; index != NO_PARENT; index = search.nodes[index].parent) {
+            SymbolNumber sym = search.nodes[index].symbol;
+            if (sym != 0 && sym < symbol_table.size() &&
+                !lexicon->is_flag(sym)) {
+                symbols.push_back(sym);
+            }
+        }
+        std::string retval;
+        for (std::vector<SymbolNumber>::reverse_iterator it = symbols.rbegin();
+             it != symbols.rend(); ++it) {
+            retval.append(symbol_table[*it]);
+        }
+        return retval;
+    }
+
+    bool init_search(Search & search, const Encoder & encoder,
+                     const std::string & line, SymbolNumber other) const
+    {
+        std::vector<char> buf(line.begin(), line.end());
+        buf.push_back('\0');
+        char * p = &buf[0];
+        while (*p != '\0') {
+            SymbolNumber k = const_cast<Encoder &>(encoder).find_key(&p);
+            if (k == NO_SYMBOL_NUMBER) {
+                if (other == NO_SYMBOL_NUMBER) {
+                    return false;
+                }
+                // Skip the rest of the utf-8 character
+                int bytes = nByte_utf8(static_cast<unsigned char>(*p));
+                for (int i = 0; i < (bytes > 0 ? bytes : 1) && *p != '\0';
+                     ++i) {
+                    ++p;
+                }
+                k = other;
+            }
+            search.input.push_back(k);
+        }
+        hfst::FdState<SymbolNumber> flags(lexicon->get_fd_table());
+        intern_flag_state(search, flags.get_values());
+        SearchNode start = {NO_PARENT, 0, 0, 0, 0, 0, 0, 0.0, false};
+        push(search, start);
+        return true;
+    }
+
+    static void hash_value(uint64_t & h, uint64_t value)
+    {
+        // FNV-1a over the bytes of value
+        for (int i = 0; i < 8; ++i) {
+            h ^= (value >> (8 * i)) & 0xff;
+            h *= 1099511628211ULL;
+        }
+    }
+
+    static void hash_weight(uint64_t & h, Weight w)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &w, sizeof(bits));
+        hash_value(h, bits);
+    }
+
+    static void hash_transducer(uint64_t & h, const Transducer & t)
+    {
+        const TransducerHeader & header = t.get_header();
+        hash_value(h, header.symbol_count());
+        hash_value(h, header.index_table_size());
+        hash_value(h, header.target_table_size());
+        for (TransitionTableIndex i = 0; i < header.index_table_size(); ++i) {
+            const TransitionIndex & index = t.get_index(i);
+            hash_value(h, index.get_input_symbol());
+            hash_value(h, index.get_target());
+        }
+        for (TransitionTableIndex i = 0; i < header.target_table_size(); ++i) {
+            const Transition & transition = t.get_transition(i);
+            hash_value(h, transition.get_input_symbol());
+            hash_value(h, transition.get_output_symbol());
+            hash_value(h, transition.get_target());
+            hash_weight(h, transition.get_weight());
+        }
+    }
+
+public:
+    BestFirstSpeller(Transducer * mutator_ptr, Transducer * lexicon_ptr):
+        mutator(mutator_ptr), lexicon(lexicon_ptr)
+        {
+            // Speller's constructor builds the translator, extending the
+            // lexicon's alphabet with any mutator symbols it lacks
+            Speller speller(mutator_ptr, lexicon_ptr);
+            alphabet_translator = speller.alphabet_translator;
+            symbol_table = speller.symbol_table;
+        }
+
+    BestFirstSpeller(const Speller & speller):
+        mutator(speller.mutator), lexicon(speller.lexicon),
+        alphabet_translator(speller.alphabet_translator),
+        symbol_table(speller.symbol_table) {}
+
+    /** A hash of the mutator, the lexicon and the symbols, to tell whether
+        results saved from another speller apply to this one. Costs a pass
+        over the tables of both transducers.
+    */
+    uint64_t fingerprint(void) const
+    {
+        uint64_t h = 14695981039346656037ULL;
+        hash_transducer(h, *mutator);
+        hash_transducer(h, *lexicon);
+        for (size_t i = 0; i < symbol_table.size(); ++i) {
+            for (size_t c = 0; c < symbol_table[i].size(); ++c) {
+                hash_value(h, static_cast<unsigned char>(symbol_table[i][c]));
+            }
+            hash_value(h, 0x100);
+        }
+        return h;
+    }
+
+    /** See if \a line is in the lexicon.
+     */
+    bool check(const std::string & line) const
+    {
+        Search search;
+        if (!init_search(search, lexicon->get_encoder(), line,
+                         NO_SYMBOL_NUMBER)) {
+            return false;
+        }
+        // Depth-first over (input position, lexicon state, flag state); the
+        // visited set stops epsilon loops
+        std::set<std::vector<unsigned int> > visited;
+        std::vector<SearchNode> stack(1, search.nodes[0]);
+        while (!stack.empty()) {
+            SearchNode node = stack.back();
+            stack.pop_back();
+            std::vector<unsigned int> key(3);
+            key[0] = node.input_state;
+            key[1] = node.lexicon_state;
+            key[2] = node.flag_state;
+            if (!visited.insert(key).second) {
+                continue;
+            }
+            if (node.input_state == search.input.size() &&
+                lexicon->final_index(node.lexicon_state)) {
+                return true;
+            }
+            if (lexicon->has_epsilons_or_flags(node.lexicon_state + 1)) {
+                TransitionTableIndex next = lexicon->next_e(node.lexicon_state);
+                STransition i_s = lexicon->take_epsilons_and_flags(next);
+                while (i_s.symbol != NO_SYMBOL_NUMBER) {
+                    SymbolNumber in =
+                        lexicon->get_transition(next).get_input_symbol();
+                    SearchNode child = node;
+                    child.lexicon_state = i_s.index;
+                    if (in != 0) {
+                        hfst::FdState<SymbolNumber> flags(
+                            lexicon->get_fd_table());
+                        flags.assign_values(search.flag_states[node.flag_state]);
+                        if (flags.apply_operation(in)) {
+                            child.flag_state =
+                                intern_flag_state(search, flags.get_values());
+                            stack.push_back(child);
+                        }
+                    } else {
+                        stack.push_back(child);
+                    }
+                    ++next;
+                    i_s = lexicon->take_epsilons_and_flags(next);
+                }
+            }
+            if (node.input_state < search.input.size()) {
+                SymbolNumber sym = search.input[node.input_state];
+                if (lexicon->has_transitions(node.lexicon_state + 1, sym)) {
+                    TransitionTableIndex next = lexicon->next(node.lexicon_state,
+                                                              sym);
+                    STransition i_s = lexicon->take_non_epsilons(next, sym);
+                    while (i_s.symbol != NO_SYMBOL_NUMBER) {
+                        SearchNode child = node;
+                        child.lexicon_state = i_s.index;
+                        child.input_state = node.input_state + 1;
+                        stack.push_back(child);
+                        ++next;
+                        i_s = lexicon->take_non_epsilons(next, sym);
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    /** Return up to \a settings.nbest corrections of \a line, best first,
+        in the same queue type as Speller::correct().
+    */
+    CorrectionQueue correct(const std::string & line,
+                            const SpellerSearchSettings & settings =
+                            SpellerSearchSettings()) const
+    {
+        CorrectionQueue retval;
+        Search search;
+        search.prune_dominated = settings.prune_dominated;
+        if (!init_search(search, mutator->get_encoder(), line,
+                         mutator->get_unknown_symbol())) {
+            return retval;
+        }
+        std::set<std::string> found;
+        Weight best = INFINITE_WEIGHT;
+        while (!search.frontier.empty()) {
+            size_t index = search.frontier.top();
+            search.frontier.pop();
+            const SearchNode node = search.nodes[index];
+            if (settings.max_weight >= 0.0 && node.weight > settings.max_weight) {
+                break;
+            }
+            if (settings.beam >= 0.0 && found.size() != 0 &&
+                node.weight > best + settings.beam) {
+                break;
+            }
+            if (node.complete) {
+                std::string correction = stringify(search, index);
+                if (found.insert(correction).second) {
+                    if (found.size() == 1) {
+                        best = node.weight;
+                    }
+                    retval.push(StringWeightPair(correction, node.weight));
+                    if (settings.nbest != 0 && found.size() >= settings.nbest) {
+                        break;
+                    }
+                }
+                continue;
+            }
+            if (!claim_expansion(search, node, settings.nbest)) {
+                continue;
+            }
+            lexicon_epsilons(search, index);
+            mutator_epsilons(search, index);
+            if (node.input_state == search.input.size()) {
+                if (mutator->final_index(node.mutator_state) &&
+                    lexicon->final_index(node.lexicon_state)) {
+                    SearchNode done = extend(search, index, node, 0,
+                                             node.input_state,
+                                             node.mutator_state,
+                                             node.lexicon_state, 0.0);
+                    done.weight += mutator->final_weight(node.mutator_state)
+                        + lexicon->final_weight(node.lexicon_state);
+                    done.complete = true;
+                    push(search, done);
+                }
+            } else {
+                consume_input(search, index);
+            }
+        }
+        return retval;
+    }
+};
+
+/** \brief Batch spell checking and correction on a pool of threads.
+
+    All threads share one BestFirstSpeller, and so one alphabet translator
+    and the same transducers, which are only read. The workers are started
+    once and reused for every batch; results come back in input order.
+
+    One batch runs at a time: calls from several threads wait for each
+    other. If a word throws, the rest of the batch is skipped and the first
+    exception is rethrown in the calling thread once all workers are done.
+*/
+class BatchSpeller
+{
+protected:
+    const BestFirstSpeller & speller;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    // Held for the whole of a batch, so batches don't overlap
+    std::mutex run_mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+    // The current batch
+    std::function<void(size_t)> job;
+    size_t job_size;
+    std::atomic<size_t> next_item;
+    // Workers that are through with the current batch. Every worker takes
+    // part in every batch, so the job can't be replaced under a late one.
+    size_t finished_workers;
+    unsigned long generation;
+    bool stopping;
+    // The first exception thrown by the current batch
+    std::exception_ptr error;
+
+    void worker_loop(void)
+    {
+        unsigned long seen_generation = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                work_available.wait(lock, [&] {
+                        return stopping || generation != seen_generation; });
+                if (stopping) {
+                    return;
+                }
+                seen_generation = generation;
+            }
+            work();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++finished_workers;
+            }
+            work_done.notify_all();
+        }
+    }
+
+    // Take items until there are no more. An exception skips the rest of
+    // the batch and is kept for run() to rethrow.
+    void work(void)
+    {
+        try {
+            size_t i;
+            while ((i = next_item++) < job_size) {
+                job(i);
+            }
+        } catch (...) {
+            next_item = job_size;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+
+    // Call f on 0 .. n-1 on all threads. Not reentrant: f must not use
+    // this BatchSpeller.
+    void run(size_t n, const std::function<void(size_t)> & f)
+    {
+        if (workers.size() == 0) {
+            for (size_t i = 0; i < n; ++i) {
+                f(i);
+            }
+            return;
+        }
+        std::lock_guard<std::mutex> run_lock(run_mutex);
+        std::unique_lock<std::mutex> lock(mutex);
+        job = f;
+        job_size = n;
+        next_item = 0;
+        finished_workers = 0;
+        error = std::exception_ptr();
+        ++generation;
+        work_available.notify_all();
+        // The calling thread takes items too. The workers use f, which
+        // refers to the caller's results, so they are always waited for.
+        lock.unlock();
+        work();
+        lock.lock();
+        work_done.wait(lock, [&] {
+                return finished_workers == workers.size(); });
+        job = std::function<void(size_t)>();
+        if (error) {
+            std::exception_ptr e = error;
+            error = std::exception_ptr();
+            std::rethrow_exception(e);
+        }
+    }
+
+public:
+    /** Use \a threads threads in total, including the calling one; 0 means
+        one per hardware thread.
+    */
+    BatchSpeller(const BestFirstSpeller & s, unsigned int threads = 0):
+        speller(s), job_size(0), next_item(0), finished_workers(0),
+        generation(0), stopping(false)
+        {
+            if (threads == 0) {
+                threads = std::thread::hardware_concurrency();
+            }
+            for (unsigned int i = 1; i < threads; ++i) {
+                workers.push_back(std::thread(&BatchSpeller::worker_loop,
+                                              this));
+            }
+        }
+
+    ~BatchSpeller(void)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            work_available.notify_all();
+            for (size_t i = 0; i < workers.size(); ++i) {
+                workers[i].join();
+            }
+        }
+
+    /** Check each of \a words; the i'th result is for the i'th word.
+     */
+    std::vector<bool> check(const std::vector<std::string> & words)
+    {
+        std::vector<char> results(words.size(), 0);
+        run(words.size(), [&](size_t i) {
+                results[i] = speller.check(words[i]); });
+        return std::vector<bool>(results.begin(), results.end());
+    }
+
+    /** Correct each of \a words; the i'th result is for the i'th word.
+     */
+    std::vector<CorrectionQueue> correct(
+        const std::vector<std::string> & words,
+        const SpellerSearchSettings & settings = SpellerSearchSettings())
+    {
+        std::vector<CorrectionQueue> results(words.size());
+        run(words.size(), [&](size_t i) {
+                results[i] = speller.correct(words[i], settings); });
+        return results;
+    }
+};
+
+/** \brief A bounded cache of corrections and check results in front of a
+    BestFirstSpeller.
+
+    The cache is split into shards, each with its own lock and least
+    recently used order, so that threads mostly don't contend. Corrections
+    are computed with the settings given at construction. The contents can be
+    saved and loaded, so that repeated runs over similar text start warm.
+*/
+class CachingSpeller
+{
+protected:
+    struct Entry
+    {
+        std::string form;
+        bool has_check;
+        bool check_result;
+        bool has_corrections;
+        std::vector<StringWeightPair> corrections;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::list<Entry> entries;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    };
+
+    static const size_t shard_count = 16;
+
+    const BestFirstSpeller & speller;
+    SpellerSearchSettings settings;
+    size_t shard_capacity;
+    Shard shards[shard_count];
+    std::atomic<unsigned long long> hits;
+    std::atomic<unsigned long long> misses;
+    // The first line of a saved cache: the format version and a hash of
+    // the speller and the settings that the results depend on. Hashing the
+    // speller costs a pass over its transducers, so it is only done for
+    // the first save() or load().
+    std::string header;
+    std::once_flag header_once;
+
+    const std::string & get_header(void)
+    {
+        std::call_once(header_once, [this]() {
+                std::ostringstream os;
+                os << "hfst-ospell-cache\t2\t" << std::hex << std::setw(16)
+                   << std::setfill('0') << speller.fingerprint() << std::dec
+                   << std::setprecision(
+                       std::numeric_limits<Weight>::max_digits10)
+                   << '\t' << settings.nbest << '\t' << settings.beam
+                   << '\t' << settings.max_weight
+                   << '\t' << (settings.prune_dominated ? 1 : 0);
+                header = os.str();
+            });
+        return header;
+    }
+
+    Shard & shard_for(const std::string & form)
+    {
+        return shards[std::hash<std::string>()(form) % shard_count];
+    }
+
+    // The entry for @a form, created if missing and moved to the front.
+    // The shard must be locked.
+    Entry & touch(Shard & shard, const std::string & form)
+    {
+        std::unordered_map<std::string, std::list<Entry>::iterator>::iterator
+            it = shard.index.find(form);
+        if (it != shard.index.end()) {
+            shard.entries.splice(shard.entries.begin(), shard.entries,
+                                 it->second);
+            return *it->second;
+        }
+        Entry entry;
+        entry.form = form;
+        entry.has_check = false;
+        entry.check_result = false;
+        entry.has_corrections = false;
+        shard.entries.push_front(entry);
+        shard.index[form] = shard.entries.begin();
+        while (shard.entries.size() > shard_capacity) {
+            shard.index.erase(shard.entries.back().form);
+            shard.entries.pop_back();
+        }
+        return shard.entries.front();
+    }
+
+    static CorrectionQueue to_queue(const std::vector<StringWeightPair> & v)
+    {
+        CorrectionQueue retval;
+        for (size_t i = 0; i < v.size(); ++i) {
+            retval.push(v[i]);
+        }
+        return retval;
+    }
+
+    static std::string escape(const std::string & str)
+    {
+        std::string retval;
+        for (size_t i = 0; i < str.size(); ++i) {
+            switch (str[i]) {
+            case '\\': retval += "\\\\"; break;
+            case '\t': retval += "\\t"; break;
+            case '\n': retval += "\\n"; break;
+            case '\r': retval += "\\r"; break;
+            default: retval += str[i];
+            }
+        }
+        return retval;
+    }
+
+    static std::string unescape(const std::string & str)
+    {
+        std::string retval;
+        for (size_t i = 0; i < str.size(); ++i) {
+            if (str[i] == '\\' && i + 1 < str.size()) {
+                ++i;
+                switch (str[i]) {
+                case 't': retval += '\t'; break;
+                case 'n': retval += '\n'; break;
+                case 'r': retval += '\r'; break;
+                default: retval += str[i];
+                }
+            } else {
+                retval += str[i];
+            }
+        }
+        return retval;
+    }
+
+    static std::vector<std::string> split_tabs(const std::string & line)
+    {
+        std::vector<std::string> fields;
+        std::string::size_type start = 0;
+        while (true) {
+            std::string::size_type tab = line.find('\t', start);
+            fields.push_back(line.substr(start, tab - start));
+            if (tab == std::string::npos) {
+                break;
+            }
+            start = tab + 1;
+        }
+        return fields;
+    }
+
+public:
+    /** Cache up to \a capacity forms in total.
+     */
+    CachingSpeller(const BestFirstSpeller & s,
+                   const SpellerSearchSettings & search_settings =
+                   SpellerSearchSettings(),
+                   size_t capacity = 100000):
+        speller(s), settings(search_settings),
+        shard_capacity(capacity / shard_count + 1), hits(0), misses(0)
+        {}
+
+    bool check(const std::string & line)
+    {
+        Shard & shard = shard_for(line);
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            std::unordered_map<std::string,
+                               std::list<Entry>::iterator>::iterator it =
+                shard.index.find(line);
+            if (it != shard.index.end() && it->second->has_check) {
+                ++hits;
+                return touch(shard, line).check_result;
+            }
+        }
+        ++misses;
+        bool result = speller.check(line);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Entry & entry = touch(shard, line);
+        entry.has_check = true;
+        entry.check_result = result;
+        return result;
+    }
+
+    CorrectionQueue correct(const std::string & line)
+    {
+        Shard & shard = shard_for(line);
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            std::unordered_map<std::string,
+                               std::list<Entry>::iterator>::iterator it =
+                shard.index.find(line);
+            if (it != shard.index.end() && it->second->has_corrections) {
+                ++hits;
+                return to_queue(touch(shard, line).corrections);
+            }
+        }
+        ++misses;
+        CorrectionQueue result = speller.correct(line, settings);
+        std::vector<StringWeightPair> corrections;
+        CorrectionQueue copy = result;
+        while (!copy.empty()) {
+            corrections.push_back(copy.top());
+            copy.pop();
+        }
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Entry & entry = touch(shard, line);
+        entry.has_corrections = true;
+        entry.corrections = corrections;
+        return result;
+    }
+
+    unsigned long long get_hits(void) const { return hits; }
+    unsigned long long get_misses(void) const { return misses; }
+    double get_hit_rate(void) const
+    {
+        unsigned long long total = hits + misses;
+        return total == 0 ? 0.0 : static_cast<double>(hits) / total;
+    }
+
+    void clear(void)
+    {
+        for (size_t i = 0; i < shard_count; ++i) {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            shards[i].entries.clear();
+            shards[i].index.clear();
+        }
+        hits = 0;
+        misses = 0;
+    }
+
+    /** Write the cache to \a os. The first line identifies the speller
+        and the settings. Then comes one form per line: the form, the check
+        result (1, 0 or - for unknown), and then either - or the number of
+        corrections followed by each correction and its weight, all separated
+        by tabs. Weights are written with enough digits to read back
+        exactly.
+    */
+    void save(std::ostream & os)
+    {
+        std::streamsize precision = os.precision(
+            std::numeric_limits<Weight>::max_digits10);
+        os << get_header() << '\n';
+        for (size_t i = 0; i < shard_count; ++i) {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            // Oldest first, so that loading restores the recency order
+            for (std::list<Entry>::reverse_iterator it =
+                     shards[i].entries.rbegin();
+                 it != shards[i].entries.rend(); ++it) {
+                os << escape(it->form) << '\t'
+                   << (it->has_check ? (it->check_result ? "1" : "0") : "-")
+                   << '\t';
+                if (!it->has_corrections) {
+                    os << '-';
+                } else {
+                    os << it->corrections.size();
+                    for (size_t c = 0; c < it->corrections.size(); ++c) {
+                        os << '\t' << escape(it->corrections[c].first)
+                           << '\t' << it->corrections[c].second;
+                    }
+                }
+                os << '\n';
+            }
+        }
+        os.precision(precision);
+    }
+
+    /** Add the contents of a cache written by save(). Returns false if the
+        stream isn't a cache file, or was saved from a different speller or
+        with different settings; malformed lines are skipped.
+    */
+    bool load(std::istream & is)
+    {
+        std::string line;
+        if (!std::getline(is, line) || line != get_header()) {
+            return false;
+        }
+        while (std::getline(is, line)) {
+            std::vector<std::string> fields = split_tabs(line);
+            if (fields.size() < 3) {
+                continue;
+            }
+            Entry loaded;
+            loaded.form = unescape(fields[0]);
+            loaded.has_check = fields[1] != "-";
+            loaded.check_result = fields[1] == "1";
+            loaded.has_corrections = fields[2] != "-";
+            if (loaded.has_corrections) {
+                size_t n = 0;
+                std::istringstream(fields[2]) >> n;
+                if (fields.size() != 3 + 2 * n) {
+                    continue;
+                }
+                for (size_t c = 0; c < n; ++c) {
+                    Weight w = 0.0;
+                    std::istringstream(fields[4 + 2 * c]) >> w;
+                    loaded.corrections.push_back(
+                        StringWeightPair(unescape(fields[3 + 2 * c]), w));
+                }
+            }
+            Shard & shard = shard_for(loaded.form);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            Entry & entry = touch(shard, loaded.form);
+            entry = loaded;
+        }
+        return true;
+    }
+};
+
+}
+
+#endif //_HFST_OL_TRANSDUCER_SPELLER_H_
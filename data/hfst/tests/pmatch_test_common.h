@@ -0,0 +1,58 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+#ifndef _HFST_PMATCH_TEST_COMMON_H_
+#define _HFST_PMATCH_TEST_COMMON_H_
+
+// Helpers shared by the tests of the pmatch additions
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "HfstTransducer.h"
+#include "parsers/pmatch_utils.h"
+#include "implementations/optimized-lookup/pmatch.h"
+
+namespace hfst_test {
+
+  // The transducers of a pmatch grammar in the order hfst-pmatch2fst writes
+  // them: TOP first, then the other definitions, all in optimized-lookup
+  // format. A PmatchContainer can be constructed from the result.
+  inline std::vector<hfst::HfstTransducer> compile_pmatch
+  (const std::string & grammar)
+  {
+    std::map<std::string, hfst::HfstTransducer *> definitions;
+    std::map<std::string, hfst::HfstTransducer *> compiled =
+      hfst::pmatch::compile(grammar, definitions,
+                            hfst::TROPICAL_OPENFST_TYPE);
+    std::vector<hfst::HfstTransducer> transducers;
+    std::map<std::string, hfst::HfstTransducer *>::iterator top =
+      compiled.find("TOP");
+    if (top != compiled.end())
+      {
+        top->second->convert(hfst::HFST_OLW_TYPE);
+        transducers.push_back(*top->second);
+      }
+    for (std::map<std::string, hfst::HfstTransducer *>::iterator it =
+           compiled.begin(); it != compiled.end(); ++it)
+      {
+        if (it != top)
+          {
+            it->second->convert(hfst::HFST_OLW_TYPE);
+            transducers.push_back(*it->second);
+          }
+        delete it->second;
+      }
+    return transducers;
+  }
+
+}
+
+#endif // #ifndef _HFST_PMATCH_TEST_COMMON_H_
@@ -0,0 +1,207 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+// BatchSpeller gives the results of the BestFirstSpeller it shares, in
+// input order, with any number of threads. Its pool passes an exception
+// from a job to the caller and stays usable afterwards, and batches
+// started from several threads at once do not mix.
+
+#include <stdexcept>
+
+#include "HfstTransducer.h"
+#include "implementations/ConvertTransducerFormat.h"
+#include "implementations/optimized-lookup/speller.h"
+#include "test_common.h"
+
+using namespace hfst_test;
+using hfst::implementations::ConversionFunctions;
+using hfst_ol::BatchSpeller;
+using hfst_ol::BestFirstSpeller;
+using hfst_ol::CorrectionQueue;
+using hfst_ol::SpellerSearchSettings;
+using hfst_ol::StringWeightPair;
+
+namespace {
+
+  const unsigned int LETTERS = 5;
+
+  // An acceptor of the words, as a trie
+  HfstBasicTransducer make_lexicon(const std::vector<std::string> &words)
+  {
+    HfstBasicTransducer lexicon;
+    HfstState next = 1;
+    for (size_t i = 0; i < words.size(); ++i)
+      {
+        HfstState s = 0;
+        for (size_t c = 0; c < words[i].size(); ++c)
+          {
+            std::string letter(1, words[i][c]);
+            const HfstBasicTransitions &arcs = lexicon.transitions(s);
+            HfstState target = next;
+            for (size_t a = 0; a < arcs.size(); ++a)
+              {
+                if (arcs[a].get_input_symbol() == letter)
+                  { target = arcs[a].get_target_state(); }
+              }
+            if (target == next)
+              {
+                lexicon.add_transition(s, HfstBasicTransition
+                                       (next, letter, letter, 0.0));
+                ++next;
+              }
+            s = target;
+          }
+        lexicon.set_final_weight(s, 0.0);
+      }
+    return lexicon;
+  }
+
+  // Substitutions, deletions and insertions of the letters at weight 1
+  HfstBasicTransducer make_error_model(void)
+  {
+    HfstBasicTransducer model;
+    const std::string &eps = hfst::internal_epsilon;
+    for (unsigned int i = 0; i < LETTERS; ++i)
+      {
+        for (unsigned int j = 0; j < LETTERS; ++j)
+          {
+            model.add_transition(0, HfstBasicTransition
+                                 (0, symbol(i), symbol(j),
+                                  i == j ? 0.0 : 1.0));
+          }
+        model.add_transition(0, HfstBasicTransition(0, symbol(i), eps, 1.0));
+        model.add_transition(0, HfstBasicTransition(0, eps, symbol(i), 1.0));
+      }
+    model.set_final_weight(0, 0.0);
+    return model;
+  }
+
+  std::string random_word(Random &random)
+  {
+    std::string word;
+    unsigned int length = 1 + random(6);
+    for (unsigned int i = 0; i < length; ++i)
+      { word += symbol(random(LETTERS)); }
+    return word;
+  }
+
+  std::vector<StringWeightPair> to_vector(CorrectionQueue queue)
+  {
+    std::vector<StringWeightPair> retval;
+    while (!queue.empty())
+      {
+        retval.push_back(queue.top());
+        queue.pop();
+      }
+    return retval;
+  }
+
+  // Gives the tests the pool itself, to run synthetic jobs on
+  class TestBatchSpeller : public BatchSpeller
+  {
+  public:
+    TestBatchSpeller(const BestFirstSpeller &s, unsigned int threads):
+      BatchSpeller(s, threads) {}
+    using BatchSpeller::run;
+  };
+
+  struct JobError : public std::runtime_error
+  {
+    JobError(): std::runtime_error("job failed") {}
+  };
+
+  void check_pool(const BestFirstSpeller &speller, unsigned int threads)
+  {
+    TestBatchSpeller pool(speller, threads);
+    const size_t n = 10000;
+
+    // Every item is done exactly once
+    std::vector<int> counts(n, 0);
+    pool.run(n, [&counts](size_t i) { ++counts[i]; });
+    for (size_t i = 0; i < n; ++i)
+      { CHECK(counts[i] == 1); }
+
+    // A throwing item stops the batch and its exception reaches the caller
+    bool caught = false;
+    try
+      {
+        pool.run(n, [](size_t i)
+                 {
+                   if (i == 5000)
+                     { throw JobError(); }
+                 });
+      }
+    catch (const JobError &)
+      { caught = true; }
+    CHECK(caught);
+
+    // The pool is still usable, and batches from two threads wait for
+    // each other instead of mixing
+    std::vector<int> first(n, 0);
+    std::vector<int> second(n, 0);
+    std::thread other([&pool, &second]()
+                      { pool.run(n, [&second](size_t i) { ++second[i]; }); });
+    pool.run(n, [&first](size_t i) { ++first[i]; });
+    other.join();
+    for (size_t i = 0; i < n; ++i)
+      { CHECK(first[i] == 1 && second[i] == 1); }
+  }
+
+}
+
+int main(void)
+{
+  Random random(33);
+  std::vector<std::string> words;
+  for (unsigned int i = 0; i < 200; ++i)
+    { words.push_back(random_word(random)); }
+  HfstBasicTransducer lexicon_basic = make_lexicon(words);
+  HfstBasicTransducer model_basic = make_error_model();
+  hfst_ol::Transducer * lexicon =
+    ConversionFunctions::hfst_basic_transducer_to_hfst_ol(&lexicon_basic,
+                                                          true);
+  hfst_ol::Transducer * model =
+    ConversionFunctions::hfst_basic_transducer_to_hfst_ol(&model_basic,
+                                                          true);
+  BestFirstSpeller speller(model, lexicon);
+
+  std::vector<std::string> inputs;
+  for (unsigned int i = 0; i < 500; ++i)
+    { inputs.push_back(random_word(random)); }
+  inputs.insert(inputs.end(), words.begin(), words.begin() + 50);
+  SpellerSearchSettings settings(5, -1.0, 2.0);
+
+  std::vector<bool> expected_checks;
+  std::vector<std::vector<StringWeightPair> > expected_corrections;
+  for (size_t i = 0; i < inputs.size(); ++i)
+    {
+      expected_checks.push_back(speller.check(inputs[i]));
+      expected_corrections.push_back
+        (to_vector(speller.correct(inputs[i], settings)));
+    }
+  CHECK(expected_checks[inputs.size() - 1]);
+
+  unsigned int thread_counts[] = { 1, 2, 4, 8 };
+  for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]);
+       ++t)
+    {
+      BatchSpeller batch(speller, thread_counts[t]);
+      CHECK(batch.check(inputs) == expected_checks);
+      std::vector<CorrectionQueue> corrections =
+        batch.correct(inputs, settings);
+      CHECK(corrections.size() == inputs.size());
+      for (size_t i = 0; i < inputs.size(); ++i)
+        { CHECK(to_vector(corrections[i]) == expected_corrections[i]); }
+      check_pool(speller, thread_counts[t]);
+    }
+
+  delete lexicon;
+  delete model;
+  return 0;
+}
@@ -0,0 +1,125 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+#ifndef _HFST_TEST_COMMON_H_
+#define _HFST_TEST_COMMON_H_
+
+// Helpers shared by the tests in this directory.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+
+#include "implementations/HfstBasicTransducer.h"
+
+// Unlike assert(), not compiled out with NDEBUG
+#define CHECK(condition) do {                                         \
+    if (!(condition))                                                 \
+      {                                                               \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,        \
+                __LINE__, #condition);                                \
+        exit(1);                                                      \
+      }                                                               \
+  } while (false)
+
+namespace hfst_test {
+
+  using hfst::implementations::HfstBasicTransducer;
+  using hfst::implementations::HfstBasicTransition;
+  using hfst::implementations::HfstBasicTransitions;
+  using hfst::implementations::HfstState;
+
+  // A small random number generator that gives the same numbers on every
+  // platform
+  class Random
+  {
+  public:
+    Random(unsigned long seed): state(seed * 2654435761ul + 1) {}
+    unsigned int operator()(unsigned int n)
+    {
+      state = state * 6364136223846793005ull + 1442695040888963407ull;
+      return static_cast<unsigned int>(state >> 33) % n;
+    }
+  private:
+    unsigned long long state;
+  };
+
+  inline std::string symbol(unsigned int i)
+  { return std::string(1, static_cast<char>('a' + i)); }
+
+  // A random transducer over the symbols a, b, ... with weights from
+  // {0, 0.5, 1, 1.5}. If deterministic, no state has two transitions with
+  // the same symbol pair. If weighted is false, all weights are zero.
+  inline HfstBasicTransducer random_transducer
+  (Random &random, unsigned int states, unsigned int symbols,
+   unsigned int max_arcs, bool deterministic, bool weighted = true,
+   bool epsilons = false)
+  {
+    HfstBasicTransducer t;
+    t.add_state(states - 1);
+    for (HfstState s = 0; s < states; ++s)
+      {
+        std::set<std::pair<unsigned int, unsigned int> > used;
+        unsigned int arcs = random(max_arcs + 1);
+        for (unsigned int i = 0; i < arcs; ++i)
+          {
+            unsigned int in = random(symbols);
+            unsigned int out = random(symbols);
+            if (deterministic && !used.insert(std::make_pair(in, out)).second)
+              { continue; }
+            std::string isymbol = symbol(in);
+            std::string osymbol = symbol(out);
+            if (epsilons && random(5) == 0)
+              { isymbol = osymbol = hfst::internal_epsilon; }
+            float weight = weighted ? 0.5f * random(4) : 0.0f;
+            t.add_transition(s, HfstBasicTransition(random(states), isymbol,
+                                                    osymbol, weight));
+          }
+        if (random(3) == 0)
+          { t.set_final_weight(s, weighted ? 0.5f * random(3) : 0.0f); }
+      }
+    return t;
+  }
+
+  // Whether t1 and t2 have the same states, numbered the same, with the
+  // same transitions in the same order and the same final weights
+  inline bool identical(const HfstBasicTransducer &t1,
+                        const HfstBasicTransducer &t2)
+  {
+    if (t1.get_max_state() != t2.get_max_state())
+      { return false; }
+    for (HfstState s = 0; s <= t1.get_max_state(); ++s)
+      {
+        const HfstBasicTransitions &a1 = t1.transitions(s);
+        const HfstBasicTransitions &a2 = t2.transitions(s);
+        if (a1.size() != a2.size())
+          { return false; }
+        for (size_t i = 0; i < a1.size(); ++i)
+          {
+            if (a1[i].get_target_state() != a2[i].get_target_state() ||
+                a1[i].get_input_symbol() != a2[i].get_input_symbol() ||
+                a1[i].get_output_symbol() != a2[i].get_output_symbol() ||
+                a1[i].get_weight() != a2[i].get_weight())
+              { return false; }
+          }
+        if (t1.is_final_state(s) != t2.is_final_state(s))
+          { return false; }
+        if (t1.is_final_state(s) &&
+            t1.get_final_weight(s) != t2.get_final_weight(s))
+          { return false; }
+      }
+    return true;
+  }
+
+}
+
+#endif // #ifndef _HFST_TEST_COMMON_H_
@@ -0,0 +1,225 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+// ComposeIntersectParallel must give exactly the result of
+// ComposeIntersectLexicon, state numbers and transition order included,
+// for any number of threads.
+
+#include "test_common.h"
+#include "implementations/compose_intersect/ComposeIntersectParallel.h"
+#include "implementations/compose_intersect/ComposeIntersectLexicon.h"
+#include "implementations/compose_intersect/ComposeIntersectRulePair.h"
+
+using namespace hfst_test;
+using hfst::implementations::ComposeIntersectLexicon;
+using hfst::implementations::ComposeIntersectParallel;
+using hfst::implementations::ComposeIntersectRule;
+using hfst::implementations::ComposeIntersectRulePair;
+
+namespace {
+
+  typedef std::vector<std::pair<std::string, std::string> > PairVector;
+
+  // The pairs that the lexicon output can meet in the rules
+  PairVector rule_pairs(void)
+  {
+    PairVector pairs;
+    const char * symbols[] = { "c", "a", "t", "d", "o", "g" };
+    for (size_t i = 0; i < sizeof(symbols) / sizeof(symbols[0]); ++i)
+      { pairs.push_back(std::make_pair(symbols[i], symbols[i])); }
+    pairs.push_back(std::make_pair("a", "e"));
+    pairs.push_back(std::make_pair("o", "u"));
+    pairs.push_back(std::make_pair(hfst::internal_epsilon, "h"));
+    return pairs;
+  }
+
+  void add_arc(HfstBasicTransducer &t, HfstState s, HfstState target,
+               const std::string &isymbol, const std::string &osymbol,
+               float weight = 0.0)
+  { t.add_transition(s, HfstBasicTransition(target, isymbol, osymbol,
+                                            weight)); }
+
+  // Epsilons on both sides, an epsilon output, a flag diacritic and a
+  // cycle
+  HfstBasicTransducer make_lexicon(void)
+  {
+    HfstBasicTransducer lexicon;
+    const std::string &eps = hfst::internal_epsilon;
+    add_arc(lexicon, 0, 1, "c", "c");
+    add_arc(lexicon, 1, 2, "@P.X.ON@", "@P.X.ON@");
+    add_arc(lexicon, 2, 3, "a", "a", 0.5);
+    add_arc(lexicon, 3, 4, eps, "t");
+    add_arc(lexicon, 0, 5, "d", "d");
+    add_arc(lexicon, 5, 6, eps, eps, 0.25);
+    add_arc(lexicon, 6, 7, "o", "o");
+    add_arc(lexicon, 7, 4, "G", "g");
+    add_arc(lexicon, 4, 8, "+Pl", eps);
+    add_arc(lexicon, 8, 4, "a", "a", 1.0);
+    lexicon.set_final_weight(4, 0.0);
+    lexicon.set_final_weight(8, 0.125);
+    return lexicon;
+  }
+
+  // At most one h is inserted.
+  HfstBasicTransducer make_insertion_rule(const PairVector &pairs)
+  {
+    HfstBasicTransducer rule;
+    for (PairVector::const_iterator it = pairs.begin(); it != pairs.end();
+         ++it)
+      {
+        if (it->second == "h")
+          { add_arc(rule, 0, 1, it->first, it->second); }
+        else
+          {
+            add_arc(rule, 0, 0, it->first, it->second);
+            add_arc(rule, 1, 1, it->first, it->second);
+          }
+      }
+    rule.set_final_weight(0, 0.0);
+    rule.set_final_weight(1, 0.0);
+    return rule;
+  }
+
+  // Vowels change at a cost.
+  HfstBasicTransducer make_weight_rule(const PairVector &pairs)
+  {
+    HfstBasicTransducer rule;
+    for (PairVector::const_iterator it = pairs.begin(); it != pairs.end();
+         ++it)
+      {
+        float weight = it->first != it->second &&
+          it->first != hfst::internal_epsilon ? 1.5 : 0.0;
+        add_arc(rule, 0, 0, it->first, it->second, weight);
+      }
+    rule.set_final_weight(0, 0.0);
+    return rule;
+  }
+
+  // No t right after an a on the input side
+  HfstBasicTransducer make_context_rule(const PairVector &pairs)
+  {
+    HfstBasicTransducer rule;
+    for (PairVector::const_iterator it = pairs.begin(); it != pairs.end();
+         ++it)
+      {
+        if (it->first == hfst::internal_epsilon)
+          {
+            add_arc(rule, 0, 0, it->first, it->second);
+            add_arc(rule, 1, 1, it->first, it->second);
+            continue;
+          }
+        HfstState target = it->first == "a" ? 1 : 0;
+        add_arc(rule, 0, target, it->first, it->second);
+        if (it->first != "t")
+          { add_arc(rule, 1, target, it->first, it->second); }
+      }
+    rule.set_final_weight(0, 0.0);
+    rule.set_final_weight(1, 0.0);
+    return rule;
+  }
+
+  // The same balanced tree that ComposeIntersectParallel builds
+  ComposeIntersectRule * make_rule_tree
+  (const std::vector<HfstBasicTransducer> &rules, size_t begin, size_t end)
+  {
+    if (end - begin == 1)
+      { return new ComposeIntersectRule(rules[begin]); }
+    size_t middle = begin + (end - begin) / 2;
+    return new ComposeIntersectRulePair(make_rule_tree(rules, begin, middle),
+                                        make_rule_tree(rules, middle, end));
+  }
+
+  HfstBasicTransducer compose_sequentially
+  (const HfstBasicTransducer &lexicon,
+   const std::vector<HfstBasicTransducer> &rules)
+  {
+    ComposeIntersectLexicon sequential(lexicon);
+    ComposeIntersectRule * rule_tree = make_rule_tree(rules, 0, rules.size());
+    HfstBasicTransducer result = sequential.compose_with_rules(rule_tree);
+    delete rule_tree;
+    return result;
+  }
+
+  void check_against_sequential(const HfstBasicTransducer &lexicon,
+                                const std::vector<HfstBasicTransducer> &rules)
+  {
+    HfstBasicTransducer expected = compose_sequentially(lexicon, rules);
+    unsigned int thread_counts[] = { 1, 2, 4 };
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]);
+         ++i)
+      {
+        ComposeIntersectParallel parallel(lexicon, rules, thread_counts[i]);
+        CHECK(identical(parallel.compose(), expected));
+      }
+  }
+
+  // A random rule over the pairs x:x and x:y of the symbols of
+  // random_transducer, with some epsilon inputs. All states are final, so
+  // that the rules do not cut everything off.
+  HfstBasicTransducer random_rule(Random &random, unsigned int symbols)
+  {
+    HfstBasicTransducer rule;
+    unsigned int states = 1 + random(4);
+    rule.add_state(states - 1);
+    for (HfstState s = 0; s < states; ++s)
+      {
+        for (unsigned int i = 0; i < symbols; ++i)
+          {
+            add_arc(rule, s, random(states), symbol(i), symbol(i),
+                    0.5f * random(2));
+            if (random(3) == 0)
+              { add_arc(rule, s, random(states), symbol(i),
+                        symbol(random(symbols)), 0.5f * random(3)); }
+          }
+        if (random(4) == 0)
+          { add_arc(rule, s, random(states), hfst::internal_epsilon,
+                    symbol(random(symbols))); }
+        rule.set_final_weight(s, 0.5f * random(2));
+      }
+    return rule;
+  }
+
+}
+
+int main(void)
+{
+  PairVector pairs = rule_pairs();
+  std::vector<HfstBasicTransducer> rules;
+  rules.push_back(make_insertion_rule(pairs));
+  rules.push_back(make_weight_rule(pairs));
+  rules.push_back(make_context_rule(pairs));
+  check_against_sequential(make_lexicon(), rules);
+
+  Random random(38);
+  for (unsigned int i = 0; i < 200; ++i)
+    {
+      unsigned int symbols = 2 + random(3);
+      HfstBasicTransducer lexicon =
+        random_transducer(random, 2 + random(40), symbols, 3, false, true,
+                          true);
+      std::vector<HfstBasicTransducer> random_rules;
+      unsigned int rule_count = 1 + random(5);
+      for (unsigned int j = 0; j < rule_count; ++j)
+        { random_rules.push_back(random_rule(random, symbols)); }
+      check_against_sequential(lexicon, random_rules);
+    }
+
+  // Levels of more than one chunk, so that several workers share the rule
+  // tree
+  HfstBasicTransducer lexicon =
+    random_transducer(random, 3000, 4, 3, false, true, true);
+  for (HfstState s = 0; s + 1 < 3000; ++s)
+    { add_arc(lexicon, s, s + 1, symbol(s % 4), symbol(s % 4)); }
+  std::vector<HfstBasicTransducer> random_rules;
+  for (unsigned int j = 0; j < 4; ++j)
+    { random_rules.push_back(random_rule(random, 4)); }
+  check_against_sequential(lexicon, random_rules);
+
+  return 0;
+}
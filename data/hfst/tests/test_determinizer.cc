@@ -0,0 +1,178 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+// HfstDeterminizer gives the same result with any number of threads, a
+// transducer with no epsilon:epsilon transitions and no two transitions
+// with the same symbol pair from a state, the same lightest weight for
+// every path as the input, and a transducer equivalent to the input and,
+// without weights, as large as the backend's determinization.
+
+#include <map>
+
+#include "HfstTransducer.h"
+#include "implementations/HfstDeterminizer.h"
+#include "test_common.h"
+
+using namespace hfst;
+using namespace hfst::implementations;
+using namespace hfst_test;
+
+namespace {
+
+  typedef std::map<StringPairVector, float> WeightMap;
+
+  // The lightest weight of each sequence of symbol pairs accepted by the
+  // acyclic transducer t, with epsilon:epsilon pairs left out
+  void lightest_paths(const HfstBasicTransducer &t, HfstState s, float weight,
+                      StringPairVector &path, WeightMap &weights)
+  {
+    if (t.is_final_state(s))
+      {
+        float total = weight + t.get_final_weight(s);
+        WeightMap::iterator it = weights.find(path);
+        if (it == weights.end())
+          { weights[path] = total; }
+        else if (total < it->second)
+          { it->second = total; }
+      }
+    const HfstBasicTransitions &arcs = t.transitions(s);
+    for (size_t i = 0; i < arcs.size(); ++i)
+      {
+        bool epsilon = arcs[i].get_input_symbol() == internal_epsilon &&
+          arcs[i].get_output_symbol() == internal_epsilon;
+        if (!epsilon)
+          { path.push_back(StringPair(arcs[i].get_input_symbol(),
+                                      arcs[i].get_output_symbol())); }
+        lightest_paths(t, arcs[i].get_target_state(),
+                       weight + arcs[i].get_weight(), path, weights);
+        if (!epsilon)
+          { path.pop_back(); }
+      }
+  }
+
+  WeightMap lightest_paths(const HfstBasicTransducer &t)
+  {
+    StringPairVector path;
+    WeightMap weights;
+    lightest_paths(t, 0, 0.0, path, weights);
+    return weights;
+  }
+
+  bool is_deterministic(const HfstBasicTransducer &t)
+  {
+    for (HfstState s = 0; s <= t.get_max_state(); ++s)
+      {
+        std::set<StringPair> pairs;
+        const HfstBasicTransitions &arcs = t.transitions(s);
+        for (size_t i = 0; i < arcs.size(); ++i)
+          {
+            StringPair pair(arcs[i].get_input_symbol(),
+                            arcs[i].get_output_symbol());
+            if (pair.first == internal_epsilon &&
+                pair.second == internal_epsilon)
+              { return false; }
+            if (!pairs.insert(pair).second)
+              { return false; }
+          }
+      }
+    return true;
+  }
+
+  // A random acyclic transducer: every transition leads to a later state.
+  // Weighted determinization terminates on any acyclic input.
+  HfstBasicTransducer random_acyclic(Random &random, unsigned int states,
+                                     unsigned int symbols)
+  {
+    HfstBasicTransducer t;
+    t.add_state(states - 1);
+    for (HfstState s = 0; s + 1 < states; ++s)
+      {
+        unsigned int arcs = random(4);
+        for (unsigned int i = 0; i < arcs; ++i)
+          {
+            std::string isymbol = symbol(random(symbols));
+            std::string osymbol = symbol(random(symbols));
+            if (random(5) == 0)
+              { isymbol = osymbol = internal_epsilon; }
+            HfstState target = s + 1 + random(states - s - 1);
+            t.add_transition(s, HfstBasicTransition(target, isymbol, osymbol,
+                                                    0.5f * random(4)));
+          }
+      }
+    for (HfstState s = 0; s < states; ++s)
+      {
+        if (random(3) == 0)
+          { t.set_final_weight(s, 0.5f * random(3)); }
+      }
+    return t;
+  }
+
+  HfstBasicTransducer check_determinizer(const HfstBasicTransducer &t)
+  {
+    HfstDeterminizer single(t, 1);
+    HfstBasicTransducer result = single.determinize();
+    CHECK(is_deterministic(result));
+    unsigned int thread_counts[] = { 2, 4 };
+    for (size_t i = 0; i < 2; ++i)
+      {
+        HfstDeterminizer determinizer(t, thread_counts[i]);
+        CHECK(identical(determinizer.determinize(), result));
+      }
+    return result;
+  }
+
+}
+
+int main(void)
+{
+  bool backend =
+    HfstTransducer::is_implementation_type_available(TROPICAL_OPENFST_TYPE);
+  Random random(41);
+
+  // Weighted and acyclic: every path keeps its lightest weight
+  for (int i = 0; i < 300; ++i)
+    {
+      HfstBasicTransducer t = random_acyclic(random, 2 + random(8), 3);
+      HfstBasicTransducer result = check_determinizer(t);
+      CHECK(lightest_paths(result) == lightest_paths(t));
+      if (!backend)
+        { continue; }
+      HfstTransducer original(t, TROPICAL_OPENFST_TYPE);
+      HfstTransducer determinized(result, TROPICAL_OPENFST_TYPE);
+      CHECK(determinized.compare(original));
+    }
+
+  // Unweighted and cyclic, with epsilons
+  for (int i = 0; i < 300; ++i)
+    {
+      HfstBasicTransducer t =
+        random_transducer(random, 1 + random(12), 3, 4, false, false,
+                          i % 2 == 0);
+      HfstBasicTransducer result = check_determinizer(t);
+      if (!backend)
+        { continue; }
+      HfstTransducer original(t, TROPICAL_OPENFST_TYPE);
+      HfstTransducer determinized(result, TROPICAL_OPENFST_TYPE);
+      CHECK(determinized.compare(original));
+      bool has_epsilons = i % 2 == 0;
+      if (!has_epsilons)
+        {
+          // Both build the reachable subsets of the same automaton
+          HfstTransducer reference(original);
+          reference.determinize();
+          HfstBasicTransducer reference_basic(reference);
+          CHECK(reference_basic.get_max_state() == result.get_max_state());
+        }
+    }
+
+  // Large enough for each level to be split between the threads
+  Random big_random(9);
+  check_determinizer(random_transducer(big_random, 3000, 4, 3, true, false));
+  return 0;
+}
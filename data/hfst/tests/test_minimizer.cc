@@ -0,0 +1,184 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+// HfstMinimizer gives the same result with any number of threads, an
+// equivalent transducer and, without weights, as many states as the
+// backend's minimization and as a naive Moore refinement. Its refinement
+// runs on more than one thread.
+
+#include <map>
+
+#include "HfstTransducer.h"
+#include "implementations/HfstMinimizer.h"
+#include "test_common.h"
+
+using namespace hfst;
+using namespace hfst::implementations;
+using namespace hfst_test;
+
+// The states of t that are reachable from the start state and from which
+// a final state can be reached, renumbered in order
+static HfstBasicTransducer trim(const HfstBasicTransducer &t)
+{
+  HfstState n = t.get_max_state() + 1;
+  std::vector<bool> reachable(n, false);
+  std::vector<HfstState> agenda(1, 0);
+  reachable[0] = true;
+  while (!agenda.empty())
+    {
+      HfstState s = agenda.back();
+      agenda.pop_back();
+      const HfstBasicTransitions &arcs = t.transitions(s);
+      for (size_t i = 0; i < arcs.size(); ++i)
+        {
+          if (!reachable[arcs[i].get_target_state()])
+            {
+              reachable[arcs[i].get_target_state()] = true;
+              agenda.push_back(arcs[i].get_target_state());
+            }
+        }
+    }
+  std::vector<bool> useful(n, false);
+  for (HfstState s = 0; s < n; ++s)
+    { useful[s] = t.is_final_state(s); }
+  for (bool changed = true; changed; )
+    {
+      changed = false;
+      for (HfstState s = 0; s < n; ++s)
+        {
+          const HfstBasicTransitions &arcs = t.transitions(s);
+          for (size_t i = 0; !useful[s] && i < arcs.size(); ++i)
+            {
+              if (useful[arcs[i].get_target_state()])
+                { useful[s] = changed = true; }
+            }
+        }
+    }
+  std::vector<HfstState> number(n, 0);
+  HfstState count = 0;
+  for (HfstState s = 0; s < n; ++s)
+    {
+      if (s == 0 || (reachable[s] && useful[s]))
+        { number[s] = count++; }
+    }
+  HfstBasicTransducer retval;
+  retval.add_state(count - 1);
+  for (HfstState s = 0; s < n; ++s)
+    {
+      if (s != 0 && !(reachable[s] && useful[s]))
+        { continue; }
+      const HfstBasicTransitions &arcs = t.transitions(s);
+      for (size_t i = 0; i < arcs.size(); ++i)
+        {
+          HfstState target = arcs[i].get_target_state();
+          if (reachable[target] && useful[target])
+            {
+              retval.add_transition
+                (number[s], HfstBasicTransition
+                 (number[target], arcs[i].get_input_symbol(),
+                  arcs[i].get_output_symbol(), arcs[i].get_weight()));
+            }
+        }
+      if (t.is_final_state(s))
+        { retval.set_final_weight(number[s], t.get_final_weight(s)); }
+    }
+  return retval;
+}
+
+// The number of states of the minimal equivalent of the unweighted,
+// deterministic and trimmed t, by refining the partition into final and
+// non-final states until no block changes
+static size_t moore_state_count(const HfstBasicTransducer &t)
+{
+  typedef std::map<std::pair<std::string, std::string>, size_t> Moves;
+  HfstState n = t.get_max_state() + 1;
+  std::vector<size_t> block(n);
+  for (HfstState s = 0; s < n; ++s)
+    { block[s] = t.is_final_state(s) ? 1 : 0; }
+  size_t block_count = 0;
+  while (true)
+    {
+      std::map<std::pair<size_t, Moves>, size_t> signatures;
+      std::vector<size_t> next(n);
+      for (HfstState s = 0; s < n; ++s)
+        {
+          Moves moves;
+          const HfstBasicTransitions &arcs = t.transitions(s);
+          for (size_t i = 0; i < arcs.size(); ++i)
+            {
+              moves[std::make_pair(arcs[i].get_input_symbol(),
+                                   arcs[i].get_output_symbol())] =
+                block[arcs[i].get_target_state()];
+            }
+          std::pair<size_t, Moves> signature(block[s], moves);
+          if (signatures.count(signature) == 0)
+            {
+              size_t number = signatures.size();
+              signatures[signature] = number;
+            }
+          next[s] = signatures[signature];
+        }
+      block.swap(next);
+      if (signatures.size() == block_count)
+        { return block_count; }
+      block_count = signatures.size();
+    }
+}
+
+int main(void)
+{
+  bool backend =
+    HfstTransducer::is_implementation_type_available(TROPICAL_OPENFST_TYPE);
+  Random random(42);
+  for (int i = 0; i < 300; ++i)
+    {
+      bool weighted = i % 2 == 0;
+      HfstBasicTransducer t =
+        trim(random_transducer(random, 1 + random(12), 3, 4, true,
+                               weighted));
+      HfstFrozenTransducer frozen(t);
+      HfstMinimizer single(frozen, 1);
+      HfstBasicTransducer result = single.minimize();
+      CHECK(result.get_max_state() <= t.get_max_state());
+      unsigned int thread_counts[] = { 2, 4 };
+      for (size_t j = 0; j < 2; ++j)
+        {
+          HfstMinimizer minimizer(frozen, thread_counts[j]);
+          CHECK(identical(minimizer.minimize(), result));
+        }
+      bool empty = !t.is_final_state(0) && t.transitions(0).empty();
+      if (!weighted && !empty)
+        { CHECK(moore_state_count(t) == result.get_max_state() + 1); }
+      if (!backend)
+        { continue; }
+      HfstTransducer original(t, TROPICAL_OPENFST_TYPE);
+      HfstTransducer minimized(result, TROPICAL_OPENFST_TYPE);
+      CHECK(minimized.compare(original));
+      if (!weighted && !empty)
+        {
+          HfstTransducer reference(original);
+          reference.minimize();
+          HfstBasicTransducer reference_basic(reference);
+          CHECK(reference_basic.get_max_state() == result.get_max_state());
+        }
+    }
+
+  // Large enough for every batch of splitters to be worth several threads
+  Random big_random(7);
+  HfstBasicTransducer big =
+    random_transducer(big_random, 5000, 4, 4, true, false);
+  HfstFrozenTransducer frozen(big);
+  HfstMinimizer parallel(frozen, 4);
+  HfstBasicTransducer result = parallel.minimize();
+  CHECK(parallel.refine_thread_count() > 1);
+  HfstMinimizer single(frozen, 1);
+  CHECK(identical(single.minimize(), result));
+  CHECK(single.refine_thread_count() == 1);
+  return 0;
+}
@@ -0,0 +1,200 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+// HfstPathEnumerator passes on an exception thrown by the callback after
+// stopping its workers, gives the paths of a sequential depth-first search
+// in deterministic order with any number of threads, and finds the same
+// paths in either order.
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "test_common.h"
+#include "implementations/HfstPathEnumerator.h"
+
+using namespace hfst;
+using namespace hfst::implementations;
+using namespace hfst_test;
+
+namespace {
+
+  typedef std::vector<HfstTwoLevelPath> PathVector;
+
+  // The paths in the order of a sequential depth-first search, as the
+  // enumerator's deterministic order is documented to be
+  void depth_first(const HfstFrozenTransducer &fsm, HfstState s, float weight,
+                   int cycles, std::vector<unsigned int> &visits,
+                   StringPairVector &path, PathVector &paths)
+  {
+    if (cycles >= 0 && visits[s] > static_cast<unsigned int>(cycles))
+      { return; }
+    ++visits[s];
+    if (fsm.is_final_state(s))
+      { paths.push_back(HfstTwoLevelPath(weight + fsm.get_final_weight(s),
+                                         path)); }
+    for (HfstFrozenTransducer::const_iterator it = fsm.begin(s);
+         it != fsm.end(s); ++it)
+      {
+        path.push_back
+          (StringPair(HfstFrozenTransducer::symbol_name(it->input),
+                      HfstFrozenTransducer::symbol_name(it->output)));
+        depth_first(fsm, it->target, weight + it->weight, cycles, visits,
+                    path, paths);
+        path.pop_back();
+      }
+    --visits[s];
+  }
+
+  PathVector reference_paths(const HfstFrozenTransducer &fsm, int cycles)
+  {
+    std::vector<unsigned int> visits(fsm.state_count(), 0);
+    StringPairVector path;
+    PathVector paths;
+    depth_first(fsm, 0, 0.0, cycles, visits, path, paths);
+    return paths;
+  }
+
+  PathVector enumerate(const HfstFrozenTransducer &fsm, unsigned int threads,
+                       int max_num, int cycles, bool deterministic,
+                       size_t buffer_batches = 64)
+  {
+    HfstPathEnumerator enumerator(fsm, threads);
+    enumerator.set_buffer_size(buffer_batches);
+    PathVector paths;
+    enumerator.enumerate([&paths](const HfstTwoLevelPath &path)
+                         {
+                           paths.push_back(path);
+                           return true;
+                         },
+                         max_num, cycles, false, deterministic);
+    return paths;
+  }
+
+  // A binary tree of the given depth, so that it has 2^depth paths and
+  // every level branches
+  HfstBasicTransducer binary_tree(unsigned int depth)
+  {
+    HfstBasicTransducer t;
+    HfstState next = 1;
+    std::vector<HfstState> level(1, 0);
+    for (unsigned int d = 0; d < depth; ++d)
+      {
+        std::vector<HfstState> next_level;
+        for (size_t i = 0; i < level.size(); ++i)
+          {
+            for (unsigned int c = 0; c < 2; ++c)
+              {
+                t.add_transition(level[i], HfstBasicTransition
+                                 (next, symbol(c), symbol(c + d % 3),
+                                  0.5f * c));
+                next_level.push_back(next++);
+              }
+          }
+        level.swap(next_level);
+      }
+    for (size_t i = 0; i < level.size(); ++i)
+      { t.set_final_weight(level[i], 0.0); }
+    return t;
+  }
+
+  struct CallbackError : public std::runtime_error
+  {
+    CallbackError(): std::runtime_error("callback failed") {}
+  };
+
+  // A callback that throws after limit paths stops the enumeration with
+  // that exception, in either order and with any number of threads.
+  // Small buffers make the workers wait for room when it throws.
+  void check_exception(const HfstFrozenTransducer &fsm)
+  {
+    const size_t limit = 500;
+    unsigned int thread_counts[] = { 1, 2, 8 };
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]);
+         ++i)
+      {
+        for (int deterministic = 0; deterministic < 2; ++deterministic)
+          {
+            HfstPathEnumerator enumerator(fsm, thread_counts[i]);
+            enumerator.set_buffer_size(1);
+            size_t calls = 0;
+            bool caught = false;
+            try
+              {
+                enumerator.enumerate([&calls](const HfstTwoLevelPath &)
+                                     {
+                                       if (++calls == limit)
+                                         { throw CallbackError(); }
+                                       return true;
+                                     },
+                                     -1, -1, false, deterministic != 0);
+              }
+            catch (const CallbackError &)
+              { caught = true; }
+            CHECK(caught);
+            CHECK(calls == limit);
+          }
+      }
+  }
+
+}
+
+int main(void)
+{
+  HfstFrozenTransducer tree(binary_tree(12));
+  check_exception(tree);
+
+  // The whole tree, in depth-first order with any number of threads
+  PathVector expected = reference_paths(tree, -1);
+  CHECK(expected.size() == 4096);
+  unsigned int thread_counts[] = { 1, 2, 8 };
+  for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]);
+       ++i)
+    {
+      CHECK(enumerate(tree, thread_counts[i], -1, -1, true) == expected);
+      CHECK(enumerate(tree, thread_counts[i], -1, -1, true, 1) == expected);
+      PathVector unordered = enumerate(tree, thread_counts[i], -1, -1, false);
+      std::sort(unordered.begin(), unordered.end());
+      PathVector sorted_expected = expected;
+      std::sort(sorted_expected.begin(), sorted_expected.end());
+      CHECK(unordered == sorted_expected);
+    }
+
+  // The set overload with a limit keeps the first paths in depth-first
+  // order, whatever the number of threads
+  HfstTwoLevelPaths first(expected.begin(), expected.begin() + 100);
+  for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]);
+       ++i)
+    {
+      HfstPathEnumerator enumerator(tree, thread_counts[i]);
+      HfstTwoLevelPaths results;
+      enumerator.enumerate(results, 100);
+      CHECK(results == first);
+    }
+
+  // Random cyclic transducers, with cycles and max_num limiting the search
+  Random random(48);
+  for (unsigned int i = 0; i < 200; ++i)
+    {
+      HfstFrozenTransducer fsm(random_transducer(random, 1 + random(8), 3,
+                                                 2, false, true, true));
+      int cycles = random(2);
+      PathVector all = reference_paths(fsm, cycles);
+      int max_num = random(2) == 0 ? -1 : 1 + random(50);
+      PathVector limited = all;
+      if (max_num > 0 && limited.size() > static_cast<size_t>(max_num))
+        { limited.resize(max_num); }
+      for (size_t j = 0;
+           j < sizeof(thread_counts) / sizeof(thread_counts[0]); ++j)
+        {
+          CHECK(enumerate(fsm, thread_counts[j], max_num, cycles, true) ==
+                limited);
+        }
+    }
+  return 0;
+}
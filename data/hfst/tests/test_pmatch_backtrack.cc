@@ -0,0 +1,71 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+// PmatchBacktrackingRunner::match() must give the output of
+// PmatchContainer::match(), on grammars it runs itself and on grammars it
+// leaves to the container.
+
+#include "test_common.h"
+#include "pmatch_test_common.h"
+#include "implementations/optimized-lookup/pmatch_backtrack.h"
+
+using namespace hfst_test;
+using hfst_ol::PmatchBacktrackingRunner;
+using hfst_ol::PmatchContainer;
+
+namespace {
+
+  // Overlapping matches of different lengths, an epsilon output and a
+  // weighted tie between two tags
+  const char * simple_grammar =
+    "define TOP [ {cat} | {cats} | {dog} ] EndTag(animal) |\n"
+    "           [ {ca} EndTag(short) ] |\n"
+    "           [ {do}:0 {g} EndTag(g) ] |\n"
+    "           [ {ab}::1.0 EndTag(heavy) ] | [ {ab}::0.5 EndTag(light) ] ;\n";
+
+  // A left context, which the runner leaves to the container
+  const char * context_grammar =
+    "define TOP [ LC({the} Whitespace) {cat} EndTag(after_the) ] |\n"
+    "           [ {cat} EndTag(animal) ] ;\n";
+
+  std::string random_text(Random & random)
+  {
+    const char * vocabulary[] = { "cat", "cats", "ca", "dog", "do", "ab",
+                                  "the", " ", " ", "x", "\xc3\xa4" };
+    std::string text;
+    unsigned int pieces = random(200);
+    for (unsigned int i = 0; i < pieces; ++i)
+      { text += vocabulary[random(sizeof(vocabulary) /
+                                  sizeof(vocabulary[0]))]; }
+    return text;
+  }
+
+  void check_grammar(const char * grammar, bool applicable)
+  {
+    PmatchContainer container(compile_pmatch(grammar));
+    PmatchBacktrackingRunner runner(container);
+    CHECK(runner.is_applicable() == applicable);
+    Random random(30);
+    for (unsigned int i = 0; i < 300; ++i)
+      {
+        std::string text = random_text(random);
+        CHECK(runner.match(text) == container.match(text));
+        CHECK(runner.match(text, 0.0, 0.75) ==
+              container.match(text, 0.0, 0.75));
+      }
+  }
+
+}
+
+int main(void)
+{
+  check_grammar(simple_grammar, true);
+  check_grammar(context_grammar, false);
+  return 0;
+}
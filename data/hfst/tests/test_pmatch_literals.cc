@@ -0,0 +1,79 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+// prefiltered_match() must give the output of PmatchContainer::match(),
+// both when the prefilter covers the grammar and when it has to fall back.
+
+#include "test_common.h"
+#include "pmatch_test_common.h"
+#include "implementations/optimized-lookup/pmatch_literals.h"
+
+using namespace hfst_test;
+using hfst_ol::PmatchContainer;
+using hfst_ol::PmatchLiteralPrefilter;
+
+namespace {
+
+  // A gazetteer, which the prefilter covers
+  const char * gazetteer_grammar =
+    "define TOP [ {Helsinki} | {Turku} | {Tampere} | {Tam} ] EndTag(place) ;\n";
+
+  // A rule that is not a list of literals
+  const char * word_grammar =
+    "define TOP [ {Turku} EndTag(place) ] | [ [Alpha]+ {ssa} EndTag(loc) ] ;\n";
+
+  std::string random_text(Random & random)
+  {
+    const char * vocabulary[] = { "Helsinki", "Turku", "Tampere", "Tam",
+                                  "Tampereella", "talossa", "ja", "xTurku",
+                                  ",", "\xc3\xa4\xc3\xa4ni" };
+    const char * separators[] = { " ", " ", "  ", "\n", "\t" };
+    std::string text;
+    unsigned int words = random(300);
+    for (unsigned int i = 0; i < words; ++i)
+      {
+        text += vocabulary[random(sizeof(vocabulary) /
+                                  sizeof(vocabulary[0]))];
+        text += separators[random(sizeof(separators) /
+                                  sizeof(separators[0]))];
+      }
+    return text;
+  }
+
+  void check_grammar(const char * grammar, bool covered)
+  {
+    std::vector<hfst::HfstTransducer> transducers = compile_pmatch(grammar);
+    PmatchLiteralPrefilter prefilter;
+    for (size_t i = 0; i < transducers.size(); ++i)
+      { prefilter.add_rule(transducers[i]); }
+    CHECK(prefilter.covers_all_rules() == covered);
+    PmatchContainer container(transducers);
+    Random random(26);
+    for (unsigned int i = 0; i < 200; ++i)
+      {
+        std::string text = random_text(random);
+        CHECK(hfst_ol::prefiltered_match(container, prefilter, text) ==
+              container.match(text));
+      }
+    // Extracting the matches drops the text between them, which the
+    // prefilter would otherwise copy through.
+    container.set_extract_patterns(true);
+    std::string text = random_text(random);
+    CHECK(hfst_ol::prefiltered_match(container, prefilter, text) ==
+          container.match(text));
+  }
+
+}
+
+int main(void)
+{
+  check_grammar(gazetteer_grammar, true);
+  check_grammar(word_grammar, false);
+  return 0;
+}
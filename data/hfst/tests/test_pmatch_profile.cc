@@ -0,0 +1,76 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+// PmatchProfiler must count the same hits per pattern through the locate()
+// wrapper and through PmatchBacktrackingRunner, and the runner must count
+// the paths it abandons.
+
+#include "test_common.h"
+#include "pmatch_test_common.h"
+#include "implementations/optimized-lookup/pmatch_profile.h"
+#include "implementations/optimized-lookup/pmatch_backtrack.h"
+
+using namespace hfst_test;
+using hfst_ol::PatternId;
+using hfst_ol::PmatchBacktrackingRunner;
+using hfst_ol::PmatchContainer;
+using hfst_ol::PmatchProfiler;
+
+namespace {
+
+  // cats is only found after trying cat and ca
+  const char * grammar =
+    "define TOP [ {cat} | {cats} ] EndTag(animal) |\n"
+    "           [ {ca} EndTag(short) ] | [ {dog} EndTag(dog) ] ;\n";
+
+}
+
+int main(void)
+{
+  PmatchContainer container(compile_pmatch(grammar));
+  PmatchBacktrackingRunner runner(container);
+  CHECK(runner.is_applicable());
+
+  PmatchProfiler located(container);
+  PmatchProfiler searched(container);
+  runner.set_profiler(&searched);
+  Random random(29);
+  const char * vocabulary[] = { "cats ", "cat ", "ca ", "dog ", "x " };
+  for (unsigned int i = 0; i < 100; ++i)
+    {
+      std::string text;
+      unsigned int words = random(50);
+      for (unsigned int j = 0; j < words; ++j)
+        { text += vocabulary[random(sizeof(vocabulary) /
+                                    sizeof(vocabulary[0]))]; }
+      located.locate(container, text);
+      runner.match(text);
+    }
+
+  std::vector<PmatchProfiler::PatternStats> from_locate = located.merge();
+  std::vector<PmatchProfiler::PatternStats> from_runner = searched.merge();
+  CHECK(from_locate.size() == from_runner.size());
+  unsigned long long hits = 0;
+  for (size_t i = 0; i < from_locate.size(); ++i)
+    {
+      CHECK(from_locate[i].hits == from_runner[i].hits);
+      hits += from_runner[i].hits;
+      // The locate() wrapper cannot see the search
+      CHECK(from_locate[i].backtracks == 0);
+    }
+  CHECK(hits != 0);
+
+  // A match of cats follows cat and ca, whose arcs are off the kept path
+  PatternId animal = searched.get_id("animal");
+  CHECK(animal != hfst_ol::NO_PATTERN);
+  CHECK(from_runner[animal].hits != 0);
+  CHECK(from_runner[animal].backtracks != 0);
+  CHECK(searched.to_json().find("\"backtracks\"") != std::string::npos);
+  return 0;
+}
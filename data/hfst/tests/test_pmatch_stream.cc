@@ -0,0 +1,109 @@
+// Copyright (c) 2016 University of Helsinki
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// See the file COPYING included with this distribution for more
+// information.
+
+// PmatchStreamMatcher must give the tokens of PmatchContainer::locate on
+// the whole input, whatever size the chunks of input have.
+
+#include "test_common.h"
+#include "pmatch_test_common.h"
+#include "implementations/optimized-lookup/pmatch_stream.h"
+
+using namespace hfst_test;
+using hfst_ol_tokenize::PmatchStreamMatcher;
+using hfst_ol_tokenize::Token;
+using hfst_ol_tokenize::TokenizeSettings;
+
+namespace {
+
+  // A multi-word match, a match with left context and plain words
+  const char * grammar =
+    "define Word [Alpha]+ ;\n"
+    "define TOP [ {new} Whitespace {york} EndTag(city) ] |\n"
+    "           [ LC({the} Whitespace) Word EndTag(after_the) ] |\n"
+    "           [ Word EndTag(word) ] ;\n";
+
+  struct SimpleToken
+  {
+    uint64_t offset;
+    unsigned int length;
+    bool matched;
+    std::string output;
+    std::string tag;
+    bool operator==(const SimpleToken & another) const
+    {
+      return offset == another.offset && length == another.length &&
+        matched == another.matched && output == another.output &&
+        tag == another.tag;
+    }
+  };
+
+  SimpleToken simplify(const Token & token)
+  {
+    SimpleToken simple = { token.byte_offset, token.byte_length,
+                           token.matched, "", "" };
+    if (!token.analyses->empty())
+      {
+        simple.output = token.analyses->at(0).output;
+        simple.tag = token.analyses->at(0).tag;
+      }
+    return simple;
+  }
+
+  std::string random_text(Random & random, unsigned int words)
+  {
+    const char * vocabulary[] = { "the ", "new york ", "new ", "york ",
+                                  "cat ", "thethe ", "a, ", "\xc3\xa4iti ",
+                                  "the\n" };
+    std::string text;
+    for (unsigned int i = 0; i < words; ++i)
+      { text += vocabulary[random(sizeof(vocabulary) /
+                                  sizeof(vocabulary[0]))]; }
+    return text;
+  }
+
+}
+
+int main(void)
+{
+  hfst_ol::PmatchContainer container(compile_pmatch(grammar));
+  container.set_locate_mode(true);
+  TokenizeSettings settings;
+  Random random(28);
+  size_t buffer_sizes[] = { 1, 2, 7, 64, 100000 };
+  size_t lookaheads[] = { 32, 4096 };
+  for (unsigned int i = 0; i < 50; ++i)
+    {
+      std::string text = random_text(random, random(2000));
+      std::vector<SimpleToken> expected;
+      hfst_ol_tokenize::locate_tokens
+        (container, text, settings,
+         [&expected](const Token & token)
+         { expected.push_back(simplify(token)); });
+      for (size_t b = 0; b < sizeof(buffer_sizes) / sizeof(buffer_sizes[0]);
+           ++b)
+        {
+          for (size_t l = 0; l < sizeof(lookaheads) / sizeof(lookaheads[0]);
+               ++l)
+            {
+              std::vector<SimpleToken> tokens;
+              PmatchStreamMatcher matcher
+                (container,
+                 [&tokens](const Token & token)
+                 { tokens.push_back(simplify(token)); },
+                 settings, lookaheads[l]);
+              for (size_t pos = 0; pos < text.size(); pos += buffer_sizes[b])
+                { matcher.feed(text.substr(pos, buffer_sizes[b])); }
+              matcher.flush();
+              CHECK(tokens == expected);
+              CHECK(matcher.get_offset() == text.size());
+            }
+        }
+    }
+  return 0;
+}